@@ -0,0 +1,76 @@
+#include "AffinityWorker.h"
+#include "ConnectionManager.h"
+
+namespace Database {
+
+AffinityWorker::AffinityWorker(ConnectionManager *mgr)
+	: QThread()
+	, _mgr(mgr)
+	, _task(nullptr)
+	, _quit(false)
+{
+}
+
+AffinityWorker::~AffinityWorker()
+{
+	stop();
+	wait();
+}
+
+bool AffinityWorker::tryStart(QRunnable *task)
+{
+	QMutexLocker locker(&_mutex);
+	if (_task != nullptr || _quit) {
+		return false;
+	}
+	_task = task;
+	_condition.wakeOne();
+	return true;
+}
+
+bool AffinityWorker::isIdle() const
+{
+	QMutexLocker locker(&_mutex);
+	return (_task == nullptr);
+}
+
+void AffinityWorker::stop()
+{
+	QMutexLocker locker(&_mutex);
+	_quit = true;
+	_condition.wakeOne();
+}
+
+void AffinityWorker::run()
+{
+	forever {
+		QRunnable *task = nullptr;
+		_mutex.lock();
+		while (_task == nullptr && !_quit) {
+			_condition.wait(&_mutex);
+		}
+		task = _task;
+		_mutex.unlock();
+
+		if (task == nullptr) {
+			break;
+		}
+
+		bool autoDelete = task->autoDelete();
+		task->run();
+		if (autoDelete) {
+			delete task;
+		}
+
+		_mutex.lock();
+		_task = nullptr;
+		_mutex.unlock();
+	}
+
+	//the connection belongs to this thread
+	if (_mgr->connectionExists(this)) {
+		_mgr->closeOne(this);
+	}
+}
+
+}	//	namespace
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QWaitCondition>
+
+namespace Database {
+
+// class forward decl's
+class ConnectionManager;
+
+/**
+ * @brief Worker thread which executes the tasks of an affinity group.
+ *
+ * @details All tasks of a group run on the same thread and therefore use the same
+ * database connection with its warm caches, prepared statements and session state.
+ * The worker executes one task at a time. If it is busy tryStart() refuses the task,
+ * so the caller can fall back to the global thread pool.
+ *
+ * Workers are maintained by the ConnectionManager (see
+ * ConnectionManager::affinityWorker()).
+ */
+class AffinityWorker : public QThread
+{
+	Q_OBJECT
+
+public:
+	explicit AffinityWorker(ConnectionManager *mgr);
+	virtual ~AffinityWorker();
+
+	/**
+	 * @brief Starts the task on this worker if it is idle.
+	 * @returns \c false if the worker is busy or stopped.
+	 */
+	bool tryStart(QRunnable *task);
+
+	/**
+	 * @brief Returns \c true if no task is executed.
+	 */
+	bool isIdle() const;
+
+	/**
+	 * @brief Stops the worker after the current task. Use wait() to join.
+	 */
+	void stop();
+
+protected:
+	void run() override;
+
+private:
+	ConnectionManager *_mgr;
+	mutable QMutex _mutex;
+	QWaitCondition _condition;
+	QRunnable *_task;
+	bool _quit;
+};
+
+}	//	namespace
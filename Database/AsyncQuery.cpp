@@ -1,123 +1,559 @@
 #include "AsyncQuery.h"
+#include "AffinityWorker.h"
 #include "ConnectionManager.h"
+#include "ResultBuilder.h"
+#include "ResultExporter.h"
+#include "ResultMemory.h"
+#include "SqliteNative.h"
+#include "SqlStatement.h"
+#include "TaskScheduler.h"
+#include "TaskTrace.h"
 
 #include <QRunnable>
 #include <QElapsedTimer>
+#include <QSqlDriver>
+#include <QSqlField>
 #include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
 #include <QThreadPool>
 #include <QQueue>
+#include <QTimer>
 
 
 namespace Database {
 
+/* shared between the query and its functions waiting in the scheduler, the query
+ * pointer is reset when the query is destroyed */
+struct QueryTokenPrivate {
+	/* recursive, a dispatch under the lock may finish a canceled hold right away */
+	QueryTokenPrivate() : mutex(QMutex::Recursive), query(nullptr) {}
+	QMutex mutex;
+	AsyncQuery *query;
+};
+
+namespace {
+
+/* counts a producer of AsyncQuery while it exists */
+class ProducerGuard
+{
+public:
+	explicit ProducerGuard(QAtomicInt *count)
+		: _count(count)
+	{
+		_count->fetchAndAddOrdered(1);
+	}
+
+	~ProducerGuard()
+	{
+		_count->fetchAndAddOrdered(-1);
+	}
+
+private:
+	QAtomicInt *_count;
+};
+
+/* a Mode_Fifo or Mode_KeyedSerial task works off its queue itself until this time
+ * slice is used up */
+const qint64 QueueTimeSliceMs = 100;
+
+/* interval of AsyncQuery::exportProgress() */
+const qint64 ExportProgressMs = 250;
+
+/* longest time a query is held back by the ResultMemory budget, it runs anyway then */
+const int BudgetMaxWaitMs = 5000;
+
+}
+
 class SqlTaskPrivate : public QRunnable
 {
 public:
 	SqlTaskPrivate(AsyncQuery *instance, AsyncQuery::QueuedQuery query,
-				   ulong delayMs = 0);
+				   AsyncQuery::TaskOptions options, int retries = 0);
 
 	void run() override;
 
+	/**
+	 * @brief Sets the next query to be executed by this task.
+	 * @note Only called from AsyncQuery::taskCallback() in the context of the task.
+	 */
+	void reset(const AsyncQuery::QueuedQuery &query, AsyncQuery::TaskOptions options);
+
+	/**
+	 * @brief Milliseconds since the task was started.
+	 */
+	qint64 elapsed() const;
+
+	/**
+	 * @brief The query currently executed by this task.
+	 */
+	const AsyncQuery::QueuedQuery &query() const;
+
+	/**
+	 * @brief Number of retries of the current query.
+	 */
+	int retries() const;
+
+	/**
+	 * @brief The query is not executed, the task only delivers an error for it.
+	 */
+	void cancel();
+
+private:
+	AsyncQueryResult exec(const QSqlDatabase &db);
+	AsyncQueryResult exportTo(const QSqlDatabase &db);
+	AsyncQueryResult execScript(const QSqlDatabase &db);
+	bool bindAndExec(QSqlQuery &query, const QString &statement);
+	QString queryPlan(const QSqlDatabase &db);
+
 private:
 	AsyncQuery* _instance;
 	AsyncQuery::QueuedQuery _query;
-	ulong _delayMs;
+	AsyncQuery::TaskOptions _options;
+	int _retries;
+	bool _canceled;
+	QElapsedTimer _timer;
 
 };
 
 SqlTaskPrivate::SqlTaskPrivate(AsyncQuery *instance, AsyncQuery::QueuedQuery query,
-							   ulong delayMs)
+							   AsyncQuery::TaskOptions options, int retries)
 	: _instance(instance)
 	, _query(query)
-	, _delayMs(delayMs)
+	, _options(options)
+	, _retries(retries)
+	, _canceled(false)
+{
+}
+
+void SqlTaskPrivate::reset(const AsyncQuery::QueuedQuery &query,
+						   AsyncQuery::TaskOptions options)
+{
+	_query = query;
+	_options = options;
+	_retries = 0;
+}
+
+qint64 SqlTaskPrivate::elapsed() const
+{
+	return _timer.elapsed();
+}
+
+const AsyncQuery::QueuedQuery &SqlTaskPrivate::query() const
+{
+	return _query;
+}
+
+int SqlTaskPrivate::retries() const
 {
+	return _retries;
+}
+
+void SqlTaskPrivate::cancel()
+{
+	_canceled = true;
 }
 
 void SqlTaskPrivate::run()
 {
-	QElapsedTimer timer;
-	timer.start();
+	_timer.start();
 
 	Q_ASSERT(_instance);
 
-	ConnectionManager* conmgr = ConnectionManager::instance();
-	if (!conmgr->connectionExists()) {
-		bool ret = conmgr->open();
-		Q_ASSERT(ret);
+	//the waiting query was canceled, the error is delivered like a result
+	if (_canceled) {
+		_canceled = false;
+		AsyncQueryResult result;
+		result._error = QSqlError("Canceled", "The scheduler was stopped while the query "
+								  "was waiting", QSqlError::UnknownError);
+		result._retryCount = _retries;
+		result._tag = _query.tag;
+		//the callback may hand over the next queued query
+		if (!_instance->taskCallback(result, this)) {
+			return;
+		}
+	}
+
+	QSqlDatabase db;
+	{
+		TaskTrace::Span span("connect", _query.traceId);
+		ConnectionManager* conmgr = ConnectionManager::instance();
+		if (!conmgr->connectionExists()) {
+			bool ret = conmgr->open();
+			Q_ASSERT(ret);
+		}
+		db = conmgr->threadConnection();
+	}
+
+	forever {
+		AsyncQueryResult result = exec(db);
+		result._retryCount = _retries;
+		result._tag = _query.tag;
+
+		//transient errors are retried later, the thread is not blocked meanwhile
+		if (_instance->retryCallback(result, this)) {
+			break;
+		}
+		//send result, the callback may hand over the next queued query
+		if (!_instance->taskCallback(result, this)) {
+			break;
+		}
 	}
+}
 
-	QSqlDatabase db = conmgr->threadConnection();
+AsyncQueryResult SqlTaskPrivate::exec(const QSqlDatabase &db)
+{
+	if (_query.traceId != 0) {
+		TaskTrace::record("queued", _query.traceId, _query.enqueuedUs, TaskTrace::now());
+	}
 
 	//delay query
-	if (_delayMs > 0) {
-		QThread::currentThread()->msleep(_delayMs);
+	if (_options.delayMs > 0) {
+		TaskTrace::Span span("delay", _query.traceId);
+		QThread::currentThread()->msleep(_options.delayMs);
+	}
+
+	if (_query.kind == AsyncQuery::Kind_Partitioned) {
+		TaskTrace::Span span("scan", _query.traceId);
+		return PartitionedScan::exec(db, _query.query, _query.partition,
+									 _options.memoryLimit);
+	}
+
+	if (_query.kind == AsyncQuery::Kind_Export) {
+		TaskTrace::Span span("export", _query.traceId);
+		return exportTo(db);
+	}
+
+	if (_query.kind == AsyncQuery::Kind_Script) {
+		TaskTrace::Span span("script", _query.traceId);
+		return execScript(db);
 	}
 
+	QElapsedTimer timer;
+	timer.start();
+	qint64 prepareMs = 0;
+	qint64 execMs = 0;
 	AsyncQueryResult result;
+
+	//QSQLITE fast path, reads the values directly from the sqlite3 handle
+	SqliteNative native(db);
+	if (native.isValid()) {
+		bool succ = false;
+		{
+			TaskTrace::Span span("prepare", _query.traceId);
+			succ = native.prepare(_query.query, _query.isPrepared ? _query.boundValues
+																: QMap<QString, QVariant>());
+		}
+		prepareMs = timer.restart();
+		if (succ) {
+			TaskTrace::Span span("exec", _query.traceId);
+			succ = native.exec();
+		}
+		execMs = timer.restart();
+
+		TaskTrace::Span span("fetch", _query.traceId);
+		ResultBuilder builder(_options.memoryLimit, AsyncQuery::globalMemoryLimit());
+		builder.setInternStrings(_options.internStrings);
+		//sets the error of a failed prepare or step, no rows are fetched then
+		native.fetch(builder);
+		result = builder.result();
+	} else {
+		QSqlQuery query = QSqlQuery(db);
+		bool succ = true;
+		if (_query.isPrepared) {
+			TaskTrace::Span span("prepare", _query.traceId);
+			succ = query.prepare(_query.query);
+			prepareMs = timer.restart();
+		}
+		if (succ) {
+			TaskTrace::Span span("exec", _query.traceId);
+			bindAndExec(query, _query.query);
+		}
+		execMs = timer.restart();
+
+		TaskTrace::Span span("fetch", _query.traceId);
+		ResultBuilder builder(_options.memoryLimit, AsyncQuery::globalMemoryLimit());
+		builder.setInternStrings(_options.internStrings);
+		builder.fetch(query);
+		result = builder.result();
+	}
+	qint64 fetchMs = timer.elapsed();
+
+	//announce modified tables, e.g. for AsyncQueryModel::setAutoRefresh()
+	if (result.isValid()) {
+		bool ddl = false;
+		QStringList written = SqlStatement::writtenTables(_query.query, &ddl);
+		if (!written.isEmpty()) {
+			ConnectionManager::instance()->notifyTablesChanged(written);
+		}
+		if (ddl) {
+			ConnectionManager::instance()->notifySchemaChanged();
+		}
+	}
+
+	//slow query log, the plan is captured on the same connection
+	if (_options.slowQueryMs > 0 && prepareMs + execMs + fetchMs >= _options.slowQueryMs) {
+		SlowQueryInfo info;
+		info.query = _query.query;
+		info.boundValues = _query.boundValues;
+		if (_options.redactBoundValues) {
+			for (QMap<QString, QVariant>::iterator it = info.boundValues.begin();
+				 it != info.boundValues.end(); ++it) {
+				it.value() = QVariant("<redacted>");
+			}
+		}
+		info.prepareMs = prepareMs;
+		info.execMs = execMs;
+		info.fetchMs = fetchMs;
+		info.rowCount = result.count();
+		info.plan = queryPlan(db);
+		_instance->slowQueryCallback(info);
+	}
+
+	return result;
+}
+
+AsyncQueryResult SqlTaskPrivate::exportTo(const QSqlDatabase &db)
+{
+	ResultBuilder builder;
+	builder.setRecord(ResultExporter::summaryRecord());
+
 	QSqlQuery query = QSqlQuery(db);
+	query.setForwardOnly(true);
 	bool succ = true;
 	if (_query.isPrepared) {
 		succ = query.prepare(_query.query);
-		//bind values
-		QMapIterator<QString, QVariant> i(_query.boundValues);
-		while (i.hasNext()) {
-			i.next();
-			query.bindValue(i.key(), i.value());
-		}
 	}
 	if (succ) {
-		if (_query.isPrepared) {
-			query.exec();
+		succ = bindAndExec(query, _query.query);
+	}
+	if (!succ) {
+		builder.setError(query.lastError());
+		return builder.result();
+	}
+
+	//rows go straight from the cursor to the file
+	ResultExporter exporter(_query.exportFile, _query.exportFormat);
+	const int cols = query.record().count();
+	succ = exporter.open(query.record());
+
+	QElapsedTimer progress;
+	progress.start();
+	QVector<QVariant> row(cols);
+	while (succ && query.next()) {
+		for (int ii = 0; ii < cols; ii++) {
+			row[ii] = query.isNull(ii) ? QVariant() : query.value(ii);
 		}
-		else {
-			query.exec(_query.query);
+		succ = exporter.writeRow(row);
+
+		if (progress.elapsed() >= ExportProgressMs) {
+			_instance->progressCallback(exporter.rowCount(), exporter.bytesWritten());
+			progress.restart();
 		}
 	}
 
-	result._record = query.record();
-	result._error = query.lastError();
-	int cols = result._record.count();
+	if (succ && query.lastError().isValid()) {
+		exporter.cancel();
+		builder.setError(query.lastError());
+		return builder.result();
+	}
+	if (!succ || !exporter.finish()) {
+		exporter.cancel();
+		builder.setError(QSqlError("Export failed", exporter.errorString(),
+								   QSqlError::UnknownError));
+		return builder.result();
+	}
 
-	while (query.next()) {
-		QVector<QVariant> currow(cols);
+	_instance->progressCallback(exporter.rowCount(), exporter.bytesWritten());
 
-		for (int ii = 0; ii < cols; ii++) {
-			if (query.isNull(ii)) {
-				currow[ii] = QVariant();
+	QVector<QVariant> summary;
+	summary << _query.exportFile << exporter.rowCount() << exporter.bytesWritten();
+	builder.appendRow(summary);
+	return builder.result();
+}
+
+AsyncQueryResult SqlTaskPrivate::execScript(const QSqlDatabase &db)
+{
+	QSqlRecord record;
+	record.append(QSqlField("Executed", QVariant::Int));
+	record.append(QSqlField("Statements", QVariant::Int));
+
+	const QStringList statements = SqlStatement::split(_query.query);
+	QSqlDatabase con = db;
+	QSqlError error;
+	int executed = 0;
+
+	bool transaction = _query.scriptTransaction
+		&& con.driver()->hasFeature(QSqlDriver::Transactions);
+	if (transaction && !con.transaction()) {
+		error = con.lastError();
+	} else {
+		QSqlQuery query = QSqlQuery(con);
+		for (int ii = 0; ii < statements.size(); ii++) {
+			if (!query.exec(statements.at(ii))) {
+				error = query.lastError();
+				break;
+			}
+			query.finish();
+			executed++;
+			_instance->scriptProgressCallback(executed, statements.size());
+		}
+
+		if (transaction) {
+			if (error.isValid()) {
+				con.rollback();
+				executed = 0;
+			} else if (!con.commit()) {
+				error = con.lastError();
+				executed = 0;
 			}
-			else {
-				currow[ii] = query.value(ii);
+		}
+	}
+
+	//announce the tables of the applied statements
+	QStringList written;
+	bool ddl = false;
+	for (int ii = 0; ii < executed; ii++) {
+		bool isDdl = false;
+		QStringList tables = SqlStatement::writtenTables(statements.at(ii), &isDdl);
+		ddl = ddl || isDdl;
+		for (int jj = 0; jj < tables.size(); jj++) {
+			if (!written.contains(tables.at(jj))) {
+				written << tables.at(jj);
 			}
 		}
-		result._data.append(currow);
+	}
+	if (!written.isEmpty()) {
+		ConnectionManager::instance()->notifyTablesChanged(written);
+	}
+	if (ddl) {
+		ConnectionManager::instance()->notifySchemaChanged();
+	}
+
+	ResultBuilder builder;
+	builder.setRecord(record);
+	builder.setError(error);
+	QVector<QVariant> row;
+	row << executed << statements.size();
+	builder.appendRow(row);
+	return builder.result();
+}
+
+bool SqlTaskPrivate::bindAndExec(QSqlQuery &query, const QString &statement)
+{
+	if (_query.isPrepared) {
+		//bind values
+		QMapIterator<QString, QVariant> i(_query.boundValues);
+		while (i.hasNext()) {
+			i.next();
+			query.bindValue(i.key(), i.value());
+		}
+		return query.exec();
+	}
+	return query.exec(statement);
+}
+
+QString SqlTaskPrivate::queryPlan(const QSqlDatabase &db)
+{
+	if (_query.query.trimmed().startsWith("EXPLAIN", Qt::CaseInsensitive)) {
+		return QString();
+	}
+
+	QString statement = (db.driverName() == "QSQLITE")
+		? "EXPLAIN QUERY PLAN " + _query.query
+		: "EXPLAIN " + _query.query;
+
+	QSqlQuery plan = QSqlQuery(db);
+	if (_query.isPrepared && !plan.prepare(statement)) {
+		return QString();
+	}
+	if (!bindAndExec(plan, statement)) {
+		return QString();
 	}
 
-	//send result
-	_instance->taskCallback(result);
+	QStringList lines;
+	while (plan.next()) {
+		QStringList cols;
+		for (int ii = 0; ii < plan.record().count(); ii++) {
+			cols << plan.value(ii).toString();
+		}
+		lines << cols.join(" | ");
+	}
+	return lines.join("\n");
 }
 
 /****************************************************************************************/
 /*                                          AsyncQuery                                  */
 /****************************************************************************************/
 
+QAtomicInteger<qint64> AsyncQuery::_globalMemoryLimit(0);
+QMutex AsyncQuery::_admissionMutex;
+QWaitCondition AsyncQuery::_admissionCondition;
+QAtomicInt AsyncQuery::_inFlight(0);
+QAtomicInt AsyncQuery::_maxInFlight(0);
 
 AsyncQuery::AsyncQuery(QObject* parent /* = nullptr */)
 	: QObject(parent), logger("Database.AsyncQuery")
+	, _token(new QueryTokenPrivate)
+	, _blockedProducers(0)
 	, _deleteOnDone(false)
 	, _delayMs(0)
+	, _memoryLimit(0)
+	, _internStrings(false)
+	, _slowQueryMs(0)
+	, _redactBoundValues(false)
+	, _budgetExempt(false)
 	, _mode(Mode_Parallel)
+	, _settings(nullptr)
+	, _producers(0)
 	, _taskCnt(0)
+	, _busyMutex(QMutex::Recursive)
+	, _busy(false)
+	, _maxQueueDepth(0)
+	, _lowWaterMark(0)
+	, _queueFull(false)
+	, _overflowPolicy(Overflow_Reject)
+	, _skipRunning(false)
+	, _fifoPending(0)
+	, _fifoQueued(0)
+	, _fifoDrops(0)
+	, _keyedQueued(0)
+	, _affinity(false)
+	, _ownGroup(true)
+	, _delivery(Delivery_Immediate)
+	, _coalesceMs(0)
+	, _flushScheduled(false)
 {
+	_curQuery.isPrepared = false;
+	_curQuery.queue = Queue_None;
+	_curQuery.kind = Kind_Query;
+	qRegisterMetaType<QList<Database::AsyncQueryResult>>("QList<Database::AsyncQueryResult>");
+	qRegisterMetaType<Database::SlowQueryInfo>();
+	_affinityGroup = QString("AQ0x%1").arg((qlonglong)this, 0, 16);
+	_token->query = this;
+	publishSettings();
 }
 
 AsyncQuery::~AsyncQuery()
 {
+	{
+		//waiting retries must not dispatch to this object anymore
+		QMutexLocker locker(&_token->mutex);
+		_token->query = nullptr;
+	}
+	//the group name is derived from the address, a later object must not inherit it
+	if (_affinity && _ownGroup) {
+		ConnectionManager::instance()->releaseAffinityWorker(_affinityGroup);
+	}
+	delete _settings.load();
+	qDeleteAll(_retiredSettings);
 }
 
 void AsyncQuery::setMode(AsyncQuery::Mode mode)
 {
 	QMutexLocker locker(&_mutex);
 	_mode = mode;
+	publishSettings();
 }
 
 AsyncQuery::Mode AsyncQuery::mode()
@@ -128,14 +564,13 @@ AsyncQuery::Mode AsyncQuery::mode()
 
 bool AsyncQuery::isRunning() const
 {
-	QMutexLocker lock(&_mutex);
-	return (_taskCnt > 0);
+	return (_taskCnt.load() > 0);
 }
 
 AsyncQueryResult AsyncQuery::result() const
 {
-	QMutexLocker lock(&_mutex);
-	return _result;
+	QMutexLocker lock(&_resultMutex);
+	return _result ? *_result : AsyncQueryResult();
 }
 
 void AsyncQuery::prepare(const QString &query)
@@ -148,27 +583,160 @@ void AsyncQuery::bindValue(const QString &placeholder, const QVariant &val)
 	_curQuery.boundValues[placeholder] = val;
 }
 
-void AsyncQuery::startExec()
+void AsyncQuery::clearBoundValues()
+{
+	_curQuery.boundValues.clear();
+}
+
+void AsyncQuery::setTag(const QVariant &tag)
+{
+	_curQuery.tag = tag;
+}
+
+QVariant AsyncQuery::tag() const
+{
+	return _curQuery.tag;
+}
+
+bool AsyncQuery::startExec()
+{
+	_curQuery.isPrepared = true;
+	_curQuery.key = QString();
+	_curQuery.kind = Kind_Query;
+	return startExecIntern(_curQuery);
+}
+
+bool AsyncQuery::startExec(const QString &query)
+{
+	_curQuery.isPrepared = false;
+	_curQuery.query = query;
+	_curQuery.key = QString();
+	_curQuery.kind = Kind_Query;
+	return startExecIntern(_curQuery);
+}
+
+bool AsyncQuery::startExecKeyed(const QString &key)
+{
+	_curQuery.isPrepared = true;
+	_curQuery.key = key;
+	_curQuery.kind = Kind_Query;
+	return startExecIntern(_curQuery);
+}
+
+bool AsyncQuery::startExecKeyed(const QString &key, const QString &query)
+{
+	_curQuery.isPrepared = false;
+	_curQuery.query = query;
+	_curQuery.key = key;
+	_curQuery.kind = Kind_Query;
+	return startExecIntern(_curQuery);
+}
+
+bool AsyncQuery::startExport(const QString &fileName, AsyncQuery::ExportFormat format)
 {
 	_curQuery.isPrepared = true;
-	startExecIntern();
+	_curQuery.key = QString();
+	_curQuery.kind = Kind_Export;
+	_curQuery.exportFile = fileName;
+	_curQuery.exportFormat = format;
+	return startExecIntern(_curQuery);
+}
+
+bool AsyncQuery::startExport(const QString &query, const QString &fileName,
+							 AsyncQuery::ExportFormat format)
+{
+	_curQuery.isPrepared = false;
+	_curQuery.query = query;
+	_curQuery.key = QString();
+	_curQuery.kind = Kind_Export;
+	_curQuery.exportFile = fileName;
+	_curQuery.exportFormat = format;
+	return startExecIntern(_curQuery);
+}
+
+bool AsyncQuery::startExecScript(const QString &script, bool transaction)
+{
+	_curQuery.isPrepared = false;
+	_curQuery.query = script;
+	_curQuery.key = QString();
+	_curQuery.kind = Kind_Script;
+	_curQuery.scriptTransaction = transaction;
+	return startExecIntern(_curQuery);
+}
+
+bool AsyncQuery::restartExec()
+{
+	QSharedPointer<const QueuedQuery> query;
+	{
+		QMutexLocker locker(&_lastQueryMutex);
+		query = _lastQuery;
+	}
+	if (!query) {
+		return false;
+	}
+	return startExecIntern(*query);
+}
+
+QString AsyncQuery::lastQuery() const
+{
+	QMutexLocker locker(&_lastQueryMutex);
+	return _lastQuery ? _lastQuery->query : QString();
 }
 
-void AsyncQuery::startExec(const QString &query)
+bool AsyncQuery::startExecPartitioned(const QString &query, const QString &column,
+									  int partitions, bool ordered)
 {
 	_curQuery.isPrepared = false;
 	_curQuery.query = query;
-	startExecIntern();
+	_curQuery.key = QString();
+	_curQuery.kind = Kind_Partitioned;
+	_curQuery.partition.column = column;
+	_curQuery.partition.hasRange = false;
+	_curQuery.partition.min = 0;
+	_curQuery.partition.max = 0;
+	_curQuery.partition.partitions = partitions;
+	_curQuery.partition.ordered = ordered;
+	return startExecIntern(_curQuery);
+}
 
+bool AsyncQuery::startExecPartitionedRange(const QString &query, const QString &column,
+										   qint64 min, qint64 max,
+										   int partitions, bool ordered)
+{
+	_curQuery.isPrepared = false;
+	_curQuery.query = query;
+	_curQuery.key = QString();
+	_curQuery.kind = Kind_Partitioned;
+	_curQuery.partition.column = column;
+	_curQuery.partition.hasRange = true;
+	_curQuery.partition.min = min;
+	_curQuery.partition.max = max;
+	_curQuery.partition.partitions = partitions;
+	_curQuery.partition.ordered = ordered;
+	return startExecIntern(_curQuery);
 }
 
 bool AsyncQuery::waitDone(ulong msTimout)
 {
-	QMutexLocker lock(&_mutex);
-	if (_taskCnt > 0)
-		return _waitcondition.wait(&_mutex, msTimout);
-	else
+	if (_taskCnt.load() == 0) {
 		return true;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	QMutexLocker lock(&_mutex);
+	while (_taskCnt.load() > 0) {
+		ulong waitMs = ULONG_MAX;
+		if (msTimout != ULONG_MAX) {
+			qint64 elapsed = timer.elapsed();
+			if (elapsed >= qint64(msTimout)) {
+				return false;
+			}
+			waitMs = msTimout - ulong(elapsed);
+		}
+		_idleCondition.wait(&_mutex, waitMs);
+	}
+	return true;
 }
 
 void AsyncQuery::startExecOnce(const QString &query, QObject *receiver, const char *member)
@@ -177,80 +745,891 @@ void AsyncQuery::startExecOnce(const QString &query, QObject *receiver, const ch
 	q->_deleteOnDone = true;
 	connect(q, SIGNAL(execDone(Database::AsyncQueryResult)),
 			receiver, member);
-	q->startExec(query);
+	if (!q->startExec(query)) {
+		delete q;
+	}
 }
 
 void AsyncQuery::setDelayMs(ulong ms)
 {
 	QMutexLocker locker(&_mutex);
 	_delayMs = ms;
+	publishSettings();
 }
 
-void AsyncQuery::startExecIntern()
+void AsyncQuery::setMemoryLimit(qint64 bytes)
 {
-	QMutexLocker lock(&_mutex);
-	if (_mode == Mode_Parallel) {
-		QThreadPool* pool = QThreadPool::globalInstance();
-		SqlTaskPrivate* task = new SqlTaskPrivate(this, _curQuery, _delayMs);
-		incTaskCount();
-		pool->start(task);
-	} else {
-		if (_taskCnt == 0) {
-			QThreadPool* pool = QThreadPool::globalInstance();
-			SqlTaskPrivate* task = new SqlTaskPrivate(this, _curQuery, _delayMs);
-			incTaskCount();
-			pool->start(task);
-		} else {
-			if (_mode == Mode_Fifo) {
-				_ququ.enqueue(_curQuery);
-			} else {
-				_ququ.clear();
-				_ququ.enqueue(_curQuery);
-			}
-		}
-	}
+	QMutexLocker locker(&_mutex);
+	_memoryLimit = bytes;
+	publishSettings();
 }
 
-void AsyncQuery::incTaskCount()
+qint64 AsyncQuery::memoryLimit() const
 {
-	if (_taskCnt == 0) {
-		emit busyChanged(true);
-	}
-	_taskCnt++;
+	QMutexLocker locker(&_mutex);
+	return _memoryLimit;
 }
 
-void AsyncQuery::decTaskCount()
+void AsyncQuery::setInternStrings(bool intern)
 {
-	if (_taskCnt == 1) {
-		emit busyChanged(false);
-	}
-	_taskCnt--;
+	QMutexLocker locker(&_mutex);
+	_internStrings = intern;
+	publishSettings();
+}
 
+bool AsyncQuery::internStrings() const
+{
+	QMutexLocker locker(&_mutex);
+	return _internStrings;
 }
 
-void AsyncQuery::taskCallback(const AsyncQueryResult& result)
+void AsyncQuery::setGlobalMemoryLimit(qint64 bytes)
 {
-	_mutex.lock();
-	Q_ASSERT(_taskCnt > 0);
-	_result = result;
-	if (_mode != Mode_Parallel && !_ququ.isEmpty()) {
-		//start next query if queue not empty
-		QueuedQuery query = _ququ.dequeue();
-		QThreadPool* pool = QThreadPool::globalInstance();
-		SqlTaskPrivate* task = new SqlTaskPrivate(this, query, _delayMs);
-		pool->start(task);
-	} else {
-		decTaskCount();
-	}
+	_globalMemoryLimit.store(bytes);
+}
+
+qint64 AsyncQuery::globalMemoryLimit()
+{
+	return _globalMemoryLimit.load();
+}
 
+void AsyncQuery::setMaxQueueDepth(int depth)
+{
+	QMutexLocker locker(&_mutex);
+	_maxQueueDepth = depth;
+	publishSettings();
+	//blocked producers may be admitted now
 	_waitcondition.wakeAll();
-	_mutex.unlock();
+}
 
-	emit execDone(result);
+int AsyncQuery::maxQueueDepth() const
+{
+	QMutexLocker locker(&_mutex);
+	return _maxQueueDepth;
+}
 
-	if (_deleteOnDone) {
-		// note delete later should be thread save
-		deleteLater();
-	}
+int AsyncQuery::queueDepth() const
+{
+	QMutexLocker locker(&_mutex);
+	return queueDepthIntern();
+}
+
+void AsyncQuery::setLowWaterMark(int depth)
+{
+	QMutexLocker locker(&_mutex);
+	_lowWaterMark = depth;
+}
+
+int AsyncQuery::lowWaterMark() const
+{
+	QMutexLocker locker(&_mutex);
+	return _lowWaterMark;
+}
+
+void AsyncQuery::setOverflowPolicy(AsyncQuery::OverflowPolicy policy)
+{
+	QMutexLocker locker(&_mutex);
+	_overflowPolicy = policy;
+	publishSettings();
+}
+
+AsyncQuery::OverflowPolicy AsyncQuery::overflowPolicy() const
+{
+	QMutexLocker locker(&_mutex);
+	return _overflowPolicy;
+}
+
+void AsyncQuery::setMaxInFlight(int count)
+{
+	QMutexLocker locker(&_admissionMutex);
+	_maxInFlight.store(count);
+	_admissionCondition.wakeAll();
+}
+
+int AsyncQuery::maxInFlight()
+{
+	return _maxInFlight.load();
+}
+
+int AsyncQuery::inFlight()
+{
+	return _inFlight.load();
+}
+
+void AsyncQuery::setDelivery(AsyncQuery::Delivery delivery)
+{
+	QMutexLocker locker(&_mutex);
+	_delivery = delivery;
+	publishSettings();
+}
+
+AsyncQuery::Delivery AsyncQuery::delivery() const
+{
+	QMutexLocker locker(&_mutex);
+	return _delivery;
+}
+
+void AsyncQuery::setCoalesceIntervalMs(int ms)
+{
+	QMutexLocker locker(&_mutex);
+	_coalesceMs = ms;
+}
+
+int AsyncQuery::coalesceIntervalMs() const
+{
+	QMutexLocker locker(&_mutex);
+	return _coalesceMs;
+}
+
+void AsyncQuery::setAffinity(bool enable)
+{
+	QMutexLocker locker(&_mutex);
+	if (_affinity && !enable && _ownGroup) {
+		ConnectionManager::instance()->releaseAffinityWorker(_affinityGroup);
+	}
+	_affinity = enable;
+	publishSettings();
+}
+
+bool AsyncQuery::affinity() const
+{
+	QMutexLocker locker(&_mutex);
+	return _affinity;
+}
+
+void AsyncQuery::setAffinityGroup(const QString &group)
+{
+	QMutexLocker locker(&_mutex);
+	if (_ownGroup && group != _affinityGroup) {
+		if (_affinity) {
+			ConnectionManager::instance()->releaseAffinityWorker(_affinityGroup);
+		}
+		_ownGroup = false;
+	}
+	_affinity = true;
+	_affinityGroup = group;
+	publishSettings();
+}
+
+QString AsyncQuery::affinityGroup() const
+{
+	QMutexLocker locker(&_mutex);
+	return _affinityGroup;
+}
+
+void AsyncQuery::scheduleFlush()
+{
+	int ms = coalesceIntervalMs();
+	if (ms > 0) {
+		QTimer::singleShot(ms, this, SLOT(flushResults()));
+	} else {
+		flushResults();
+	}
+}
+
+void AsyncQuery::flushResults()
+{
+	_mutex.lock();
+	QList<AsyncQueryResult> results;
+	results.swap(_pendingResults);
+	_flushScheduled = false;
+	_mutex.unlock();
+
+	if (!results.isEmpty()) {
+		TaskTrace::Span span("deliverBatch", 0);
+		emit execDoneBatch(results);
+	}
+}
+
+void AsyncQuery::traceDelivered(qulonglong id, qlonglong sentUs)
+{
+	TaskTrace::record("delivery", id, sentUs, TaskTrace::now());
+}
+
+void AsyncQuery::setSlowQueryThresholdMs(int ms)
+{
+	QMutexLocker locker(&_mutex);
+	_slowQueryMs = ms;
+	publishSettings();
+}
+
+int AsyncQuery::slowQueryThresholdMs() const
+{
+	QMutexLocker locker(&_mutex);
+	return _slowQueryMs;
+}
+
+void AsyncQuery::setRedactBoundValues(bool redact)
+{
+	QMutexLocker locker(&_mutex);
+	_redactBoundValues = redact;
+	publishSettings();
+}
+
+bool AsyncQuery::redactBoundValues() const
+{
+	QMutexLocker locker(&_mutex);
+	return _redactBoundValues;
+}
+
+void AsyncQuery::setResultBudgetExempt(bool exempt)
+{
+	QMutexLocker locker(&_mutex);
+	_budgetExempt = exempt;
+	publishSettings();
+}
+
+bool AsyncQuery::resultBudgetExempt() const
+{
+	QMutexLocker locker(&_mutex);
+	return _budgetExempt;
+}
+
+void AsyncQuery::setRetryPolicy(const RetryPolicy &policy)
+{
+	QMutexLocker locker(&_mutex);
+	_retryPolicy = policy;
+}
+
+RetryPolicy AsyncQuery::retryPolicy() const
+{
+	QMutexLocker locker(&_mutex);
+	return _retryPolicy;
+}
+
+void AsyncQuery::publishSettings()
+{
+	Settings *settings = new Settings;
+	settings->mode = _mode;
+	settings->maxQueueDepth = _maxQueueDepth;
+	settings->overflowPolicy = _overflowPolicy;
+	settings->delivery = _delivery;
+	settings->options.delayMs = _delayMs;
+	settings->options.memoryLimit = _memoryLimit;
+	settings->options.internStrings = _internStrings;
+	settings->options.slowQueryMs = _slowQueryMs;
+	settings->options.redactBoundValues = _redactBoundValues;
+	settings->group = _affinity ? _affinityGroup : QString();
+	settings->budgetExempt = _budgetExempt;
+
+	const Settings *old = _settings.fetchAndStoreOrdered(settings);
+	if (old != nullptr) {
+		_retiredSettings.append(old);
+	}
+	reclaimSettings();
+}
+
+void AsyncQuery::reclaimSettings()
+{
+	//producers are counted before they read the snapshot and tasks read it only while
+	//counted, so none of them can hold a retired one if both counts are 0
+	if (_retiredSettings.isEmpty() || _producers.fetchAndAddOrdered(0) != 0
+			|| _taskCnt.fetchAndAddOrdered(0) != 0) {
+		return;
+	}
+	qDeleteAll(_retiredSettings);
+	_retiredSettings.clear();
+}
+
+const AsyncQuery::Settings *AsyncQuery::settings() const
+{
+	return _settings.loadAcquire();
+}
+
+void AsyncQuery::dispatch(const QueuedQuery &query, const TaskOptions &options,
+						  const QString &group, int retries)
+{
+	//no task is created for a query waiting for the result budget
+	if (holdForBudget(query, retries)) {
+		return;
+	}
+	runTask(query, options, group, retries);
+}
+
+void AsyncQuery::runTask(const QueuedQuery &query, const TaskOptions &options,
+						 const QString &group, int retries)
+{
+	SqlTaskPrivate *task = new SqlTaskPrivate(this, query, options, retries);
+	if (!group.isEmpty()) {
+		AffinityWorker *worker = ConnectionManager::instance()->affinityWorker(group);
+		if (worker != nullptr && worker->tryStart(task)) {
+			return;
+		}
+	}
+	QThreadPool::globalInstance()->start(task);
+}
+
+int AsyncQuery::queueDepthIntern() const
+{
+	int fifo = qMax(0, _fifoQueued.load() - _fifoDrops.load());
+	return _taskCnt.load() + _ququ.size() + _keyedQueued + fifo;
+}
+
+bool AsyncQuery::dropOldest(const QueuedQuery &query)
+{
+	if (query.queue == Queue_Fifo) {
+		//dropped by the task when it takes the next query
+		if (_fifoQueued.load() - _fifoDrops.load() > 0) {
+			_fifoDrops.ref();
+			return true;
+		}
+		return false;
+	}
+	if (query.queue == Queue_Keyed) {
+		QHash<QString, QQueue<QueuedQuery>>::iterator it = _keyQueues.find(query.key);
+		if (it != _keyQueues.end() && !it.value().isEmpty()) {
+			it.value().dequeue();
+			_keyedQueued--;
+			return true;
+		}
+		return false;
+	}
+	if (!_ququ.isEmpty()) {
+		_ququ.dequeue();
+		return true;
+	}
+	return false;
+}
+
+bool AsyncQuery::tryAcquireSlot()
+{
+	if (_maxInFlight.load() == 0) {
+		_inFlight.ref();
+		return true;
+	}
+	QMutexLocker locker(&_admissionMutex);
+	if (_maxInFlight.load() > 0 && _inFlight.load() >= _maxInFlight.load()) {
+		return false;
+	}
+	_inFlight.ref();
+	return true;
+}
+
+void AsyncQuery::waitForSlot()
+{
+	QMutexLocker locker(&_admissionMutex);
+	while (_maxInFlight.load() > 0 && _inFlight.load() >= _maxInFlight.load()) {
+		_admissionCondition.wait(&_admissionMutex);
+	}
+	//taken while locked, an other woken producer can not steal it
+	_inFlight.ref();
+}
+
+void AsyncQuery::releaseSlot()
+{
+	_inFlight.deref();
+	//producers only wait if there is a limit
+	if (_maxInFlight.load() > 0) {
+		QMutexLocker locker(&_admissionMutex);
+		_admissionCondition.wakeOne();
+	}
+}
+
+bool AsyncQuery::startExecIntern(QueuedQuery query)
+{
+	if (TaskTrace::isEnabled()) {
+		query.traceId = TaskTrace::nextId();
+		query.enqueuedUs = TaskTrace::now();
+	} else {
+		query.traceId = 0;
+	}
+
+	//kept for restartExec(), copied outside of the locked area
+	QSharedPointer<const QueuedQuery> last(new QueuedQuery(query));
+	_lastQueryMutex.lock();
+	_lastQuery.swap(last);
+	_lastQueryMutex.unlock();
+
+	//the snapshot is used until the query is counted as task, see reclaimSettings()
+	ProducerGuard guard(&_producers);
+	const Settings *set = settings();
+	if (set->mode == Mode_KeyedSerial && !query.key.isNull()) {
+		query.queue = Queue_Keyed;
+	} else if (set->mode == Mode_Fifo) {
+		query.queue = Queue_Fifo;
+	} else if (set->mode == Mode_SkipPrevious) {
+		query.queue = Queue_Skip;
+	} else {
+		query.queue = Queue_None;
+	}
+
+	//without a queue depth limit Mode_Parallel and Mode_Fifo do not take the lock
+	if (set->maxQueueDepth == 0) {
+		if (query.queue == Queue_None) {
+			return startTask(query, set, false);
+		}
+		if (query.queue == Queue_Fifo) {
+			return submitFifo(query, set, false);
+		}
+	}
+	return startExecLocked(query);
+}
+
+bool AsyncQuery::startExecLocked(QueuedQuery &query)
+{
+	QMutexLocker lock(&_mutex);
+	/* slot taken by waitForSlot(), it is handed back if the query needs no new task */
+	bool hasSlot = false;
+
+	forever {
+		//per object admission
+		if (_maxQueueDepth > 0 && queueDepthIntern() >= _maxQueueDepth) {
+			_queueFull = true;
+			if (hasSlot) {
+				releaseSlot();
+				hasSlot = false;
+			}
+			if (_overflowPolicy == Overflow_Block) {
+				_blockedProducers++;
+				_waitcondition.wait(&_mutex);
+				_blockedProducers--;
+				continue;
+			} else if (_overflowPolicy == Overflow_DropOldest && dropOldest(query)) {
+				qCDebug(logger) << "AsyncQuery: queue full, dropped oldest query";
+			} else {
+				qCDebug(logger) << "AsyncQuery: queue full, query rejected";
+				return false;
+			}
+		}
+
+		if (query.queue == Queue_Fifo) {
+			//admitted, queued like on unbounded objects
+			lock.unlock();
+			return submitFifo(query, settings(), hasSlot);
+		}
+
+		if (query.queue == Queue_Keyed) {
+			//a running task for the same key works off the key's queue
+			QHash<QString, QQueue<QueuedQuery>>::iterator it = _keyQueues.find(query.key);
+			if (it != _keyQueues.end()) {
+				it.value().enqueue(query);
+				_keyedQueued++;
+				if (hasSlot) {
+					releaseSlot();
+				}
+				return true;
+			}
+		} else if (query.queue == Queue_Skip && _skipRunning) {
+			//the running task works off the queue, only the latest query is kept
+			_ququ.clear();
+			_ququ.enqueue(query);
+			if (hasSlot) {
+				releaseSlot();
+			}
+			return true;
+		}
+
+		//global admission, a new task is needed
+		if (!hasSlot && !tryAcquireSlot()) {
+			if (_overflowPolicy != Overflow_Block) {
+				qCDebug(logger) << "AsyncQuery: too many tasks in flight, query rejected";
+				return false;
+			}
+			lock.unlock();
+			waitForSlot();
+			lock.relock();
+			//the state may have changed meanwhile, check again with the slot taken
+			hasSlot = true;
+			continue;
+		}
+
+		if (query.queue == Queue_Keyed) {
+			_keyQueues.insert(query.key, QQueue<QueuedQuery>());
+		} else if (query.queue == Queue_Skip) {
+			_skipRunning = true;
+		}
+
+		bool busy = incTaskCount();
+		const Settings *set = settings();
+		lock.unlock();
+		if (busy) {
+			updateBusy();
+		}
+
+		//the task is allocated and started outside of the locked area
+		dispatch(query, set->options, set->group);
+		return true;
+	}
+}
+
+bool AsyncQuery::startTask(const QueuedQuery &query, const Settings *settings, bool hasSlot)
+{
+	if (!hasSlot && !tryAcquireSlot()) {
+		if (settings->overflowPolicy != Overflow_Block) {
+			qCDebug(logger) << "AsyncQuery: too many tasks in flight, query rejected";
+			return false;
+		}
+		waitForSlot();
+	}
+	if (incTaskCount()) {
+		updateBusy();
+	}
+	dispatch(query, settings->options, settings->group);
+	return true;
+}
+
+bool AsyncQuery::submitFifo(const QueuedQuery &query, const Settings *settings, bool hasSlot)
+{
+	//a rejected query must not be published, so if no task seems to run the slot for
+	//a new one is taken before
+	if (!hasSlot && _fifoPending.load() == 0) {
+		if (!tryAcquireSlot()) {
+			if (settings->overflowPolicy != Overflow_Block) {
+				qCDebug(logger) << "AsyncQuery: too many tasks in flight, query rejected";
+				return false;
+			}
+			waitForSlot();
+		}
+		hasSlot = true;
+	}
+
+	_fifoQueued.ref();
+	_inbox.enqueue(query);
+	if (_fifoPending.fetchAndAddOrdered(1) > 0) {
+		//the running task works off the inbox
+		if (hasSlot) {
+			releaseSlot();
+		}
+		return true;
+	}
+
+	//no task runs, this producer starts one and is the consumer until then
+	if (!hasSlot && !tryAcquireSlot()) {
+		//the task ended meanwhile, the query is published already and has to wait
+		waitForSlot();
+	}
+	if (incTaskCount()) {
+		updateBusy();
+	}
+	dispatch(takeFifo(), settings->options, settings->group);
+	return true;
+}
+
+AsyncQuery::QueuedQuery AsyncQuery::takeFifo()
+{
+	QueuedQuery query;
+	forever {
+		//a query is pending, but its producer may still be linking it
+		while (!_inbox.dequeue(&query)) {
+			QThread::yieldCurrentThread();
+		}
+		_fifoQueued.deref();
+
+		//Overflow_DropOldest, the newest query is never dropped
+		int drops = _fifoDrops.load();
+		if (drops > 0 && _fifoPending.load() > 1) {
+			_fifoDrops.deref();
+			_fifoPending.deref();
+			continue;
+		}
+		if (drops > 0) {
+			//outdated, the query they were made for is already running
+			_fifoDrops.fetchAndAddOrdered(-drops);
+		}
+		return query;
+	}
+}
+
+bool AsyncQuery::incTaskCount()
+{
+	return _taskCnt.fetchAndAddOrdered(1) == 0;
+}
+
+bool AsyncQuery::decTaskCount()
+{
+	return _taskCnt.fetchAndAddOrdered(-1) == 1;
+}
+
+void AsyncQuery::updateBusy()
+{
+	//the last caller sees the final count, so the emitted states keep their order
+	QMutexLocker busyLocker(&_busyMutex);
+	bool busy = (_taskCnt.load() > 0);
+	if (busy != _busy) {
+		_busy = busy;
+		emit busyChanged(busy);
+	}
+	if (!busy) {
+		QMutexLocker locker(&_mutex);
+		reclaimSettings();
+		_idleCondition.wakeAll();
+	}
+}
+
+bool AsyncQuery::taskCallback(const AsyncQueryResult& result, SqlTaskPrivate *task)
+{
+	const Settings *set = settings();
+	const quint64 traceId = task->query().traceId;
+	const Queue queue = task->query().queue;
+	TaskTrace::Span span("callback", traceId);
+
+	//swapped under its own lock, the previous result is released outside of it
+	QSharedPointer<const AsyncQueryResult> last(new AsyncQueryResult(result));
+	_resultMutex.lock();
+	_result.swap(last);
+	_resultMutex.unlock();
+
+	//the snapshot must not be read after the task count dropped
+	const bool coalesced = (set->delivery == Delivery_Coalesced);
+	const bool bounded = (set->maxQueueDepth > 0);
+
+	bool next = false;
+	bool dispatchNext = false;
+	bool end = false;
+	bool idle = false;
+	QueuedQuery nextQuery;
+
+	if (queue == Queue_Fifo) {
+		//lock-free hand over, the task stays the only consumer of the inbox
+		if (_fifoPending.fetchAndAddOrdered(-1) > 1) {
+			nextQuery = takeFifo();
+			dispatchNext = true;
+		} else {
+			end = true;
+		}
+	} else if (queue == Queue_None) {
+		end = true;
+	}
+	if (end) {
+		idle = decTaskCount();
+	}
+
+	//the lock is only needed by the locked queues, bounded objects and coalescing
+	bool schedule = false;
+	bool lowWater = false;
+	if (queue == Queue_Skip || queue == Queue_Keyed || coalesced || bounded) {
+		_mutex.lock();
+
+		if (queue == Queue_Skip || queue == Queue_Keyed) {
+			QHash<QString, QQueue<QueuedQuery>>::iterator keyIt = _keyQueues.end();
+			QQueue<QueuedQuery> *pending = &_ququ;
+			if (queue == Queue_Keyed) {
+				keyIt = _keyQueues.find(task->query().key);
+				Q_ASSERT(keyIt != _keyQueues.end());
+				pending = &keyIt.value();
+			}
+
+			if (!pending->isEmpty()) {
+				nextQuery = pending->dequeue();
+				if (queue == Queue_Keyed) {
+					_keyedQueued--;
+				}
+				dispatchNext = true;
+			} else {
+				if (queue == Queue_Keyed) {
+					_keyQueues.erase(keyIt);
+				} else {
+					_skipRunning = false;
+				}
+				end = true;
+				idle = decTaskCount();
+			}
+		}
+
+		if (_queueFull && queueDepthIntern() <= _lowWaterMark) {
+			_queueFull = false;
+			lowWater = true;
+		}
+
+		//collect results for coalesced delivery in the thread of this object
+		if (coalesced) {
+			_pendingResults.append(result);
+			schedule = !_flushScheduled;
+			_flushScheduled = true;
+		}
+
+		//waiters are only woken on their transitions
+		if (_blockedProducers > 0) {
+			_waitcondition.wakeAll();
+		}
+		_mutex.unlock();
+	}
+
+	//work off next query in the same task and connection if time slice is left
+	if (dispatchNext && task->elapsed() < QueueTimeSliceMs) {
+		//a held query is started again when the budget allows
+		if (!holdForBudget(nextQuery, 0)) {
+			task->reset(nextQuery, set->options);
+			next = true;
+		}
+		dispatchNext = false;
+	}
+
+	if (end) {
+		releaseSlot();
+		if (idle) {
+			updateBusy();
+		}
+	}
+	if (dispatchNext) {
+		dispatch(nextQuery, set->options, set->group);
+	}
+
+	if (lowWater) {
+		emit lowWaterReached();
+	}
+	if (coalesced) {
+		if (schedule) {
+			QMetaObject::invokeMethod(this, "scheduleFlush", Qt::QueuedConnection);
+		}
+	} else {
+		emit execDone(result);
+		if (traceId != 0) {
+			QMetaObject::invokeMethod(this, "traceDelivered", Qt::QueuedConnection,
+									  Q_ARG(qulonglong, traceId),
+									  Q_ARG(qlonglong, TaskTrace::now()));
+		}
+	}
+
+	if (_deleteOnDone) {
+		// note delete later should be thread save
+		deleteLater();
+	}
+	return next;
+}
+
+bool AsyncQuery::retryCallback(const AsyncQueryResult& result, SqlTaskPrivate *task)
+{
+	if (result.isValid()) {
+		return false;
+	}
+
+	//a retry starts from the beginning, applied statements and exported rows would
+	//be repeated. Called in the task thread, so this is the connection of the script.
+	const QueuedQuery &failed = task->query();
+	if (failed.kind == Kind_Export) {
+		return false;
+	}
+	if (failed.kind == Kind_Script && !(failed.scriptTransaction
+			&& ConnectionManager::instance()->threadConnection().driver()
+				->hasFeature(QSqlDriver::Transactions))) {
+		return false;
+	}
+
+	_mutex.lock();
+	int retry = task->retries() + 1;
+	if (retry >= _retryPolicy.maxAttempts() || !_retryPolicy.isTransient(result.error())) {
+		_mutex.unlock();
+		return false;
+	}
+	int delay = _retryPolicy.backoffMs(retry);
+	_mutex.unlock();
+
+	QueuedQuery query = task->query();
+	query.enqueuedUs = TaskTrace::now();
+
+	qCDebug(logger) << "Retry" << retry << "in" << delay << "ms:"
+		<< result.error().text();
+
+	dispatchLater(delay, query, retry);
+	return true;
+}
+
+bool AsyncQuery::holdForBudget(const QueuedQuery &query, int retries)
+{
+	//only statements producing results are held back
+	if (!ResultMemory::isOverBudget() || settings()->budgetExempt
+			|| query.kind == Kind_Export || query.kind == Kind_Script
+			|| !SqlStatement::isReadOnly(query.query)) {
+		return false;
+	}
+
+	//started by the first of: results were released, the timeout, the scheduler stops
+	QSharedPointer<QueryTokenPrivate> token = _token;
+	QSharedPointer<QAtomicInt> started(new QAtomicInt(0));
+	std::function<void(bool)> start = [token, started, query, retries](bool canceled) {
+		if (!started->testAndSetOrdered(0, 1)) {
+			return;
+		}
+		QMutexLocker locker(&token->mutex);
+		if (token->query == nullptr) {
+			//the object is gone, only the slot of the query is left
+			releaseSlot();
+			return;
+		}
+		if (canceled) {
+			token->query->finishCanceled(query, retries);
+			return;
+		}
+		const Settings *set = token->query->settings();
+		TaskOptions options = set->options;
+		options.delayMs = 0;
+		token->query->runTask(query, options, set->group, retries);
+	};
+
+	int waiter = ResultMemory::waitForBudget([start]() {
+		start(false);
+	});
+	if (waiter == 0) {
+		//results were released meanwhile
+		return false;
+	}
+
+	qCDebug(logger) << "Result budget exceeded, query held back";
+	ConnectionManager::instance()->scheduler()->schedule(BudgetMaxWaitMs, [start, waiter]() {
+		ResultMemory::removeWaiter(waiter);
+		start(false);
+	}, [start, waiter]() {
+		ResultMemory::removeWaiter(waiter);
+		start(true);
+	});
+	return true;
+}
+
+void AsyncQuery::dispatchLater(qint64 delayMs, const QueuedQuery &query, int retries)
+{
+	QSharedPointer<QueryTokenPrivate> token = _token;
+	ConnectionManager::instance()->scheduler()->schedule(delayMs, [token, query, retries]() {
+		QMutexLocker locker(&token->mutex);
+		if (token->query == nullptr) {
+			//the object is gone, only the slot of the query is left
+			releaseSlot();
+			return;
+		}
+		const Settings *set = token->query->settings();
+		TaskOptions options = set->options;
+		options.delayMs = 0;
+		token->query->dispatch(query, options, set->group, retries);
+	}, [token, query, retries]() {
+		QMutexLocker locker(&token->mutex);
+		if (token->query == nullptr) {
+			releaseSlot();
+			return;
+		}
+		token->query->finishCanceled(query, retries);
+	});
+}
+
+void AsyncQuery::finishCanceled(const QueuedQuery &query, int retries)
+{
+	//the task count and slot are released by taskCallback()
+	SqlTaskPrivate *task = new SqlTaskPrivate(this, query, settings()->options, retries);
+	task->cancel();
+	QThreadPool::globalInstance()->start(task);
+}
+
+void AsyncQuery::slowQueryCallback(const SlowQueryInfo &info)
+{
+	qCWarning(logger) << "Slow query:" << info.query
+		<< "bound values:" << info.boundValues
+		<< "prepare:" << info.prepareMs << "ms"
+		<< "exec:" << info.execMs << "ms"
+		<< "fetch:" << info.fetchMs << "ms"
+		<< "rows:" << info.rowCount;
+	if (!info.plan.isEmpty()) {
+		qCWarning(logger).noquote() << "Query plan:\n" << info.plan;
+	}
+
+	emit slowQuery(info);
+}
+
+void AsyncQuery::progressCallback(qint64 rows, qint64 bytes)
+{
+	emit exportProgress(rows, bytes);
+}
+
+void AsyncQuery::scriptProgressCallback(int executed, int count)
+{
+	emit scriptProgress(executed, count);
 }
 }
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "AsyncQueryResult.h"
+#include "MpscQueue.h"
+#include "PartitionedScan.h"
+#include "RetryPolicy.h"
+#include "SlowQueryInfo.h"
 
 #include <QObject>
 #include <QString>
@@ -9,11 +13,17 @@
 #include <QWaitCondition>
 #include <QMutex>
 #include <QQueue>
+#include <QHash>
+#include <QList>
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QSharedPointer>
 
 namespace Database {
 
 // class forward decl's
 class SqlTaskPrivate;
+struct QueryTokenPrivate;
 
 /**
  * @brief Class to run a asynchron sql query.
@@ -53,7 +63,10 @@ public:
 		Mode_Parallel,
 		/** Subsquent queries for this object are started in a Fifo fashion.
 		 * A Subsequent query waits until the last query is finished.
-		 * This guarantees the order of query sequences.
+		 * This guarantees the order of query sequences. Queued queries are worked
+		 * off by the running task on the same thread and connection as long as its
+		 * time slice lasts. Queries are handed to the running task through a
+		 * lock-free queue, producers do not wait for each other.
 		 */
 		Mode_Fifo,
 		/** Same as Mode_Fifo, but if a previous startExec call is not executed
@@ -62,8 +75,54 @@ public:
 		 * ommited by using this mode.
 		 */
 		Mode_SkipPrevious,
+		/** Queries started with startExecKeyed() are serialized per key. Queries
+		 * with the same key run strictly in order, queries with different keys run
+		 * in parallel. Queries started with startExec() run as in Mode_Parallel.
+		 */
+		Mode_KeyedSerial,
 	} Mode;
 
+	/**
+	 * @brief The OverflowPolicy defines how startExec() behaves if the maximum queue
+	 * depth of this object or the global maximum of tasks in flight is reached.
+	 */
+	typedef enum OverflowPolicy {
+		/** The query is not started and startExec() returns \c false. */
+		Overflow_Reject,
+		/** startExec() blocks the calling thread until the query can be admitted. */
+		Overflow_Block,
+		/** The oldest query waiting in the queue is dropped in favour of the new one.
+		 * If no query is waiting (e.g. in Mode_Parallel) the query is rejected.
+		 */
+		Overflow_DropOldest,
+	} OverflowPolicy;
+
+	/**
+	 * @brief The Delivery defines how finished results are handed to the thread of
+	 * this object.
+	 */
+	typedef enum Delivery {
+		/** execDone() is emitted for each finished query. */
+		Delivery_Immediate,
+		/** Finished results are collected and delivered together with execDoneBatch()
+		 * once per event loop iteration or coalesce interval of the thread of this
+		 * object. execDone() is not emitted.
+		 */
+		Delivery_Coalesced,
+	} Delivery;
+
+	/**
+	 * @brief File formats of startExport().
+	 */
+	typedef enum ExportFormat {
+		/** Comma separated values (RFC 4180) with a header line. */
+		Export_Csv,
+		/** One JSON object per line. */
+		Export_JsonLines,
+		/** Binary result file, see AsyncQueryResult::load(). */
+		Export_Binary,
+	} ExportFormat;
+
 	explicit AsyncQuery(QObject* parent = nullptr);
 	virtual ~AsyncQuery();
 
@@ -93,20 +152,113 @@ public:
 	 */
 	void bindValue(const QString &placeholder, const QVariant &val);
 
+	/**
+	 * @brief Removes all values bound with bindValue().
+	 */
+	void clearBoundValues();
+
 	/**
 	 * @brief Start a prepared query execution set with prepare(const QString &query);
+	 * @returns \c false if the query was rejected by the admission control.
 	 */
-	void startExec(); //start
+	bool startExec(); //start
 
 	/**
 	 * @brief Start the execution of the query.
+	 * @returns \c false if the query was rejected by the admission control.
+	 */
+	bool startExec(const QString & query);
+
+	/**
+	 * @brief Start a prepared query with given key. In Mode_KeyedSerial all queries
+	 * with the same key are executed in order, in the other modes the key is ignored.
+	 * @returns \c false if the query was rejected by the admission control.
+	 */
+	bool startExecKeyed(const QString &key);
+
+	/**
+	 * @brief Start the execution of the query with given key.
+	 * @see startExecKeyed(const QString &key)
+	 */
+	bool startExecKeyed(const QString &key, const QString &query);
+
+	/**
+	 * @brief Start a parallel, partitioned scan of a SELECT query.
+	 * @details The query is split into partitions by ranges of the numeric result
+	 * column column between its MIN() and MAX() value. The partitions run
+	 * concurrently on separate connections and are merged into one result, which is
+	 * delivered as usual. The ranges are half-open and the outer ones unbounded, so
+	 * all rows are part of the result, rows where column is NULL in the first
+	 * partition.
+	 * @param partitions Number of partitions, 0 uses the number of threads of the
+	 * global thread pool.
+	 * @param ordered If \c true the result is ordered by column, otherwise partitions
+	 * are merged in order of completion.
+	 * @returns \c false if the query was rejected by the admission control.
+	 */
+	bool startExecPartitioned(const QString &query, const QString &column,
+							  int partitions = 0, bool ordered = true);
+
+	/**
+	 * @brief Start a parallel, partitioned scan over the range [min, max] of column.
+	 * Only rows with a value in the range are part of the result.
+	 * @see startExecPartitioned()
+	 */
+	bool startExecPartitionedRange(const QString &query, const QString &column,
+								   qint64 min, qint64 max,
+								   int partitions = 0, bool ordered = true);
+
+	/**
+	 * @brief Start a prepared query set with prepare() and write its rows to a file.
+	 * @details The rows are streamed from the query cursor into the file on the
+	 * worker thread, so exports of any size run in constant memory. The file is
+	 * replaced when the export succeeded. exportProgress() reports the progress,
+	 * the delivered result contains one summary row with the columns FileName, Rows
+	 * and Bytes, or the error of the query or the file.
+	 * @returns \c false if the query was rejected by the admission control.
+	 */
+	bool startExport(const QString &fileName, AsyncQuery::ExportFormat format);
+
+	/**
+	 * @brief Start the query and write its rows to a file.
+	 * @see startExport(const QString &fileName, AsyncQuery::ExportFormat format)
 	 */
-	void startExec(const QString & query);
+	bool startExport(const QString &query, const QString &fileName,
+					 AsyncQuery::ExportFormat format);
+
+	/**
+	 * @brief Start a script of several sql statements separated by semicolons.
+	 * @details The script is split with SqlStatement::split(), string literals,
+	 * comments and trigger bodies are respected. All statements are executed in one
+	 * task on one connection, in a transaction if transaction is \c true and the
+	 * driver supports transactions. Execution stops at the first failing statement,
+	 * the transaction is rolled back then. scriptProgress() is emitted after each
+	 * statement. The delivered result contains one summary row with the columns
+	 * Executed (number of applied statements) and Statements, and the error of the
+	 * failing statement.
+	 * @returns \c false if the script was rejected by the admission control.
+	 */
+	bool startExecScript(const QString &script, bool transaction = false);
+
+	/**
+	 * @brief Starts the last started query again, with the same bound values and
+	 * options.
+	 * @returns \c false if no query was started yet or the query was rejected by the
+	 * admission control.
+	 */
+	bool restartExec();
+
+	/**
+	 * @brief The sql statement of the last started query.
+	 */
+	QString lastQuery() const;
 
 	/**
 	 * @brief Wait for query is finished
-	 * @details This function blocks the calling thread until query is finsihed. Using
-	 * this function provides same functionallity as Qt's synchron QSqlQuery.
+	 * @details This function blocks the calling thread until all queries of this
+	 * object are finsihed. Using this function provides same functionallity as Qt's
+	 * synchron QSqlQuery.
+	 * @returns \c false if the timeout expired.
 	 */
 	bool waitDone(ulong msTimout = ULONG_MAX);
 
@@ -140,56 +292,402 @@ public:
 		AsyncQuery * q = new AsyncQuery();
 		q->_deleteOnDone =true;
 		connect(q, &AsyncQuery::execDone, slot);
-		q->startExec(query);
+		if (!q->startExec(query)) {
+			delete q;
+		}
 	}	
 
+	/**
+	 * @brief Set a tag for the queries started afterwards. The tag is handed back with
+	 * AsyncQueryResult::tag(), e.g. to assign results of parallel queries.
+	 */
+	void setTag(const QVariant &tag);
+	QVariant tag() const;
+
 	/**
 	 * @brief Set delay to execute query. Mainly used for testing.
 	 * @details The executing query thread sleeps ms before query is executed.
 	 */
 	void setDelayMs(ulong ms);
 
+	/**
+	 * @brief Set the maximum number of bytes a single result may hold in memory.
+	 * @details If a result grows beyond the limit while fetching, its rows are spilled
+	 * into a temporary file which is memory mapped and read lazily through the
+	 * AsyncQueryResult getters. A value of 0 (default) disables the limit.
+	 */
+	void setMemoryLimit(qint64 bytes);
+	qint64 memoryLimit() const;
+
+	/**
+	 * @brief Set the maximum number of bytes all running queries may hold in memory
+	 * while fetching.
+	 * @details If the limit is exceeded, the fetching queries spill their rows as
+	 * described in setMemoryLimit(). A value of 0 (default) disables the limit.
+	 */
+	static void setGlobalMemoryLimit(qint64 bytes);
+	static qint64 globalMemoryLimit();
+
+	/**
+	 * @brief Intern repeated strings of text columns while fetching. Default is
+	 * \c false.
+	 * @details Equal values of a column share one implicitly shared QString, which
+	 * saves a lot of memory for denormalized results, e.g. names repeated in a join.
+	 * Columns with many distinct values are not interned. The share of deduplicated
+	 * values is reported by AsyncQueryResult::dedupRatio().
+	 */
+	void setInternStrings(bool intern);
+	bool internStrings() const;
+
+	/**
+	 * @brief Set the maximum number of queries of this object which are queued or
+	 * running. A value of 0 (default) disables the limit.
+	 * @see setOverflowPolicy()
+	 */
+	void setMaxQueueDepth(int depth);
+	int maxQueueDepth() const;
+
+	/**
+	 * @brief Number of queries of this object which are queued or running.
+	 * @note In Mode_Fifo concurrent producers are admitted without the lock, the depth
+	 * may then exceed the maximum by the number of producers.
+	 */
+	int queueDepth() const;
+
+	/**
+	 * @brief Set the queue depth at which lowWaterReached() is emitted after the
+	 * maximum queue depth was reached. Default is 0.
+	 */
+	void setLowWaterMark(int depth);
+	int lowWaterMark() const;
+
+	/**
+	 * @brief Set how startExec() behaves if a limit is reached. Default is
+	 * Overflow_Reject.
+	 */
+	void setOverflowPolicy(AsyncQuery::OverflowPolicy policy);
+	AsyncQuery::OverflowPolicy overflowPolicy() const;
+
+	/**
+	 * @brief Set the maximum number of tasks of all AsyncQuery objects in the thread
+	 * pool. A value of 0 (default) disables the limit.
+	 * @details A Mode_Fifo or Mode_SkipPrevious object occupies one task while
+	 * working off its queue, in Mode_Parallel each query occupies one task. If the
+	 * limit is reached the overflow policy of the starting object applies.
+	 */
+	static void setMaxInFlight(int count);
+	static int maxInFlight();
+
+	/**
+	 * @brief Number of tasks of all AsyncQuery objects in the thread pool.
+	 */
+	static int inFlight();
+
+	/**
+	 * @brief Set how finished results are delivered. Default is Delivery_Immediate.
+	 */
+	void setDelivery(AsyncQuery::Delivery delivery);
+	AsyncQuery::Delivery delivery() const;
+
+	/**
+	 * @brief Set the interval in which coalesced results are delivered, e.g. a frame
+	 * interval. With 0 (default) results are delivered with the next event loop
+	 * iteration.
+	 */
+	void setCoalesceIntervalMs(int ms);
+	int coalesceIntervalMs() const;
+
+	/**
+	 * @brief Route all tasks of this object to one worker thread and its connection.
+	 * @details Repeated queries then profit from warm prepared statements, caches
+	 * and session state like temporary tables. If the worker is busy the task runs
+	 * in the global thread pool. Default is \c false.
+	 * @see setAffinityGroup()
+	 */
+	void setAffinity(bool enable);
+	bool affinity() const;
+
+	/**
+	 * @brief Set the affinity group. All AsyncQuery objects of the same group share one
+	 * worker thread. If no group is set, each object has its own group.
+	 * @note Enables the affinity.
+	 */
+	void setAffinityGroup(const QString &group);
+	QString affinityGroup() const;
+
+	/**
+	 * @brief Set the threshold for the slow query log. A value of 0 (default)
+	 * disables the log.
+	 * @details If preparing, executing and fetching a query takes at least ms
+	 * milliseconds, the sql, the bound values, the timings and the row count are
+	 * logged to the category "Database.AsyncQuery". Then the query plan is captured
+	 * with EXPLAIN QUERY PLAN (SQLite) or EXPLAIN (other drivers) on the same
+	 * connection and slowQuery() is emitted before the result is delivered.
+	 */
+	void setSlowQueryThresholdMs(int ms);
+	int slowQueryThresholdMs() const;
+
+	/**
+	 * @brief Replace bound values in the slow query log. Default is \c false.
+	 */
+	void setRedactBoundValues(bool redact);
+	bool redactBoundValues() const;
+
+	/**
+	 * @brief Queries of an exempt object are not held back by the ResultMemory
+	 * budget, e.g. if their result replaces a live one. Default is \c false.
+	 */
+	void setResultBudgetExempt(bool exempt);
+	bool resultBudgetExempt() const;
+
+	/**
+	 * @brief Set the policy for retrying queries which failed with a transient error,
+	 * e.g. a locked database or a deadlock. By default queries are not retried.
+	 * @details The backoff delay is waited for in the ConnectionManager::scheduler(),
+	 * the thread of the pool is free meanwhile. The query still counts as running,
+	 * so the order of Mode_Fifo is kept. The number of retries is available with
+	 * AsyncQueryResult::retryCount(). If the scheduler is stopped before, the query
+	 * finishes with an error. Exports and scripts not running in a transaction are
+	 * not retried, since a retry starts from the beginning.
+	 */
+	void setRetryPolicy(const RetryPolicy &policy);
+	RetryPolicy retryPolicy() const;
+
 signals:
 	/**
 	 * @brief Is emited when asynchronous query is done.
 	 */
 	void execDone(const Database::AsyncQueryResult& result);
+	/**
+	 * @brief Is emitted with all results finished since the last batch if the
+	 * delivery is Delivery_Coalesced. Results are in order of completion.
+	 */
+	void execDoneBatch(const QList<Database::AsyncQueryResult>& results);
 	/**
 	 * @brief Is emited if asynchronous query running status changes.
 	 */
 	void busyChanged(bool busy);
+	/**
+	 * @brief Is emitted if the queue depth drops to the low water mark after the
+	 * maximum queue depth was reached.
+	 */
+	void lowWaterReached();
+	/**
+	 * @brief Is emitted if a query exceeded the slow query threshold.
+	 * @see setSlowQueryThresholdMs()
+	 */
+	void slowQuery(const Database::SlowQueryInfo& info);
+	/**
+	 * @brief Is emitted periodically while an export started with startExport() is
+	 * running, and once when all rows are written.
+	 */
+	void exportProgress(qint64 rows, qint64 bytes);
+	/**
+	 * @brief Is emitted after each statement of a script started with
+	 * startExecScript().
+	 */
+	void scriptProgress(int executed, int count);
+
+private slots:
+	void scheduleFlush();
+	void flushResults();
+	/* end of the delivery span, queued after execDone() */
+	void traceDelivered(qulonglong id, qlonglong sentUs);
 
 private:
+	/* how a query is serialized, decided by the mode when it is started */
+	typedef enum Queue {
+		/** a task per query, Mode_Parallel */
+		Queue_None,
+		/** _inbox, worked off by a single task */
+		Queue_Fifo,
+		/** _ququ of Mode_SkipPrevious */
+		Queue_Skip,
+		/** queue of its key in _keyQueues */
+		Queue_Keyed,
+	} Queue;
+
+	/* what the task does with the query, set by each startExec function */
+	typedef enum Kind {
+		Kind_Query,
+		/** partition, see startExecPartitioned() */
+		Kind_Partitioned,
+		/** exportFile and exportFormat, see startExport() */
+		Kind_Export,
+		/** scriptTransaction, see startExecScript() */
+		Kind_Script,
+	} Kind;
+
 	typedef struct QueuedQuery {
 		bool isPrepared;
+		Queue queue;
+		QString key;
+		Kind kind;
+		PartitionSpec partition;
+		QString exportFile;
+		ExportFormat exportFormat;
+		bool scriptTransaction;
 		QString query;
 		QMap <QString, QVariant> boundValues;
+		QVariant tag;
+		/* TaskTrace id, 0 if tracing was disabled when the query was started */
+		quint64 traceId;
+		qint64 enqueuedUs;
 	} QueuedQuery;
 
-	void startExecIntern();
+	/* settings of this object handed to a task */
+	typedef struct TaskOptions {
+		ulong delayMs;
+		qint64 memoryLimit;
+		bool internStrings;
+		int slowQueryMs;
+		bool redactBoundValues;
+	} TaskOptions;
+
+	/* settings read without the lock by producers and tasks, the setters publish a
+	 * new immutable snapshot */
+	typedef struct Settings {
+		Mode mode;
+		int maxQueueDepth;
+		OverflowPolicy overflowPolicy;
+		Delivery delivery;
+		TaskOptions options;
+		/* affinity group to dispatch to, empty if affinity is disabled */
+		QString group;
+		bool budgetExempt;
+	} Settings;
+
+	bool startExecIntern(QueuedQuery query);
+	/* Queue_Skip, Queue_Keyed and bounded queue depth */
+	bool startExecLocked(QueuedQuery &query);
+	/* starts a task for the query, the slot is taken if hasSlot is false */
+	bool startTask(const QueuedQuery &query, const Settings *settings, bool hasSlot);
+	/* hands the query to the running Mode_Fifo task or starts one */
+	bool submitFifo(const QueuedQuery &query, const Settings *settings, bool hasSlot);
+	/* next query of _inbox, only called by its consumer while _fifoPending > 0 */
+	QueuedQuery takeFifo();
 	/* use only in locked area */
-	void incTaskCount();
-	void decTaskCount();
+	void publishSettings();
+	/* frees retired snapshots if no producer or task can read them, use only in
+	 * locked area */
+	void reclaimSettings();
+	/* current snapshot, valid as long as the object lives */
+	const Settings *settings() const;
+	/* starts a task unless the query is held back by the ResultMemory budget, call
+	 * outside of the locked area */
+	void dispatch(const QueuedQuery &query, const TaskOptions &options,
+				  const QString &group, int retries = 0);
+	/* allocates and starts a task */
+	void runTask(const QueuedQuery &query, const TaskOptions &options,
+				 const QString &group, int retries);
+	/* returns true if the query waits for the ResultMemory budget, it keeps its task
+	 * count and slot meanwhile */
+	bool holdForBudget(const QueuedQuery &query, int retries);
+	/* dispatches the query again after delayMs in the scheduler, the query keeps its
+	 * task count and slot while waiting */
+	void dispatchLater(qint64 delayMs, const QueuedQuery &query, int retries);
+	/* delivers an error for a waiting query whose scheduler was stopped */
+	void finishCanceled(const QueuedQuery &query, int retries);
+	int queueDepthIntern() const;
+	bool dropOldest(const QueuedQuery &query);
+	/* return true on the transitions between idle and busy, call updateBusy() then
+	 * outside of the locked area */
+	bool incTaskCount();
+	bool decTaskCount();
+	/* emits busyChanged() if the state differs from the last emitted one */
+	void updateBusy();
+
+	// global admission control of tasks in flight, without lock if there is no limit
+	static bool tryAcquireSlot();
+	/* blocks until a slot is free and takes it */
+	static void waitForSlot();
+	static void releaseSlot();
 
 	// asynchronous callbacks
 	// attention lives in the context of QRunable
-	void taskCallback(const AsyncQueryResult& result);
+	// returns true if the task has been reset to the next queued query
+	bool taskCallback(const AsyncQueryResult& result, SqlTaskPrivate *task);
+	void slowQueryCallback(const SlowQueryInfo &info);
+	// returns true if the query is retried later, the task has to end
+	bool retryCallback(const AsyncQueryResult& result, SqlTaskPrivate *task);
+	void progressCallback(qint64 rows, qint64 bytes);
+	void scriptProgressCallback(int executed, int count);
 
 
 private:
 	QLoggingCategory logger;
+	/* shared with functions waiting in the scheduler, reset when destroyed */
+	QSharedPointer<QueryTokenPrivate> _token;
 
+	/* producers blocked by Overflow_Block */
 	QWaitCondition _waitcondition;
+	int _blockedProducers;
+	/* callers of waitDone() */
+	QWaitCondition _idleCondition;
 	mutable QMutex _mutex;
 	bool _deleteOnDone;
 	ulong _delayMs;
+	qint64 _memoryLimit;
+	bool _internStrings;
+	int _slowQueryMs;
+	bool _redactBoundValues;
+	bool _budgetExempt;
+	RetryPolicy _retryPolicy;
 	Mode _mode;
-	int _taskCnt;
+	QAtomicPointer<const Settings> _settings;
+	/* replaced snapshots may still be read, freed by reclaimSettings() */
+	QList<const Settings*> _retiredSettings;
+	/* callers of startExecIntern(), they read the snapshot before it is counted */
+	QAtomicInt _producers;
+	/* changed without lock, the transitions are handled in updateBusy() */
+	QAtomicInt _taskCnt;
+	/* last state emitted by busyChanged(), recursive for slots starting queries */
+	QMutex _busyMutex;
+	bool _busy;
+	int _maxQueueDepth;
+	int _lowWaterMark;
+	bool _queueFull;
+	OverflowPolicy _overflowPolicy;
+
+	/* last result and last query, swapped under their own locks */
+	mutable QMutex _resultMutex;
+	QSharedPointer<const AsyncQueryResult> _result;
+	mutable QMutex _lastQueryMutex;
+	QSharedPointer<const QueuedQuery> _lastQuery;
 
-	AsyncQueryResult _result;
 	QQueue <QueuedQuery> _ququ;
+	/* a Queue_Skip task runs and works off _ququ */
+	bool _skipRunning;
+	/* Mode_Fifo: lock-free queue, the consumer is the producer which starts the task
+	 * and then the task itself */
+	MpscQueue<QueuedQuery> _inbox;
+	/* Mode_Fifo queries queued or running, the task ends when it drops to 0 */
+	QAtomicInt _fifoPending;
+	/* queries in _inbox */
+	QAtomicInt _fifoQueued;
+	/* queries of _inbox to be dropped by Overflow_DropOldest */
+	QAtomicInt _fifoDrops;
+	/* queues of Mode_KeyedSerial, a key is contained while a task for it runs */
+	QHash <QString, QQueue<QueuedQuery>> _keyQueues;
+	int _keyedQueued;
 	QueuedQuery _curQuery;
 
+	bool _affinity;
+	QString _affinityGroup;
+	/* _affinityGroup is the own group of this object, released when it is not used anymore */
+	bool _ownGroup;
+
+	Delivery _delivery;
+	int _coalesceMs;
+	bool _flushScheduled;
+	QList<AsyncQueryResult> _pendingResults;
+
+	static QAtomicInteger<qint64> _globalMemoryLimit;
+
+	static QMutex _admissionMutex;
+	static QWaitCondition _admissionCondition;
+	static QAtomicInt _inFlight;
+	static QAtomicInt _maxInFlight;
 };
 
 }
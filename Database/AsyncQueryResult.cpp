@@ -1,11 +1,18 @@
 #include "AsyncQueryResult.h"
+#include "ResultFile.h"
+#include "ResultMemory.h"
+#include "ResultStore.h"
 
+#include <QBuffer>
+#include <QSaveFile>
 #include <QVariant>
 #include <QSqlError>
 
 namespace Database {
 
 AsyncQueryResult::AsyncQueryResult()
+	: _retryCount(0)
+	, _dedupRatio(0.0)
 {
 	qRegisterMetaType<AsyncQueryResult>();
 }
@@ -18,17 +25,49 @@ AsyncQueryResult::AsyncQueryResult(const AsyncQueryResult& other)
 {
 	_data = other._data;
 	_record = other._record;
+	_colIndex = other._colIndex;
 	_error = other._error;
+	_store = other._store;
+	_retryCount = other._retryCount;
+	_tag = other._tag;
+	_dedupRatio = other._dedupRatio;
+	_memory = other._memory;
 }
 
 AsyncQueryResult& AsyncQueryResult::operator=(const AsyncQueryResult& other)
 {
 	_data = other._data;
 	_record = other._record;
+	_colIndex = other._colIndex;
 	_error = other._error;
+	_store = other._store;
+	_retryCount = other._retryCount;
+	_tag = other._tag;
+	_dedupRatio = other._dedupRatio;
+	_memory = other._memory;
 	return *this;
 }
 
+int AsyncQueryResult::retryCount() const
+{
+	return _retryCount;
+}
+
+QVariant AsyncQueryResult::tag() const
+{
+	return _tag;
+}
+
+double AsyncQueryResult::dedupRatio() const
+{
+	return _dedupRatio;
+}
+
+qint64 AsyncQueryResult::memoryUsage() const
+{
+	return _memory ? _memory->bytes() : 0;
+}
+
 QSqlError AsyncQueryResult::error() const
 {
 	return _error;
@@ -41,15 +80,18 @@ QSqlRecord AsyncQueryResult::headRecord() const
 
 int AsyncQueryResult::count() const
 {
+	if (_store) {
+		return _store->count();
+	}
 	return _data.size();
 }
 
 QSqlRecord AsyncQueryResult::record(int row) const
 {
 	QSqlRecord rec = _record;
-	if (row >= 0 && row < _data.size()) {
+	if (row >= 0 && row < count()) {
 		for (int i = 0; i < _record.count(); i++) {
-			rec.setValue(i, _data[row][i]);
+			rec.setValue(i, value(row, i));
 		}
 	}
 	return rec;
@@ -57,21 +99,145 @@ QSqlRecord AsyncQueryResult::record(int row) const
 
 QVariant AsyncQueryResult::value(int row, int col) const
 {
-	if (row >= 0 && row < _data.size()) {
-		if (col >= 0 && col < _record.count())
+	if (row >= 0 && row < count()) {
+		if (col >= 0 && col < _record.count()) {
+			if (_store) {
+				return _store->value(row, col);
+			}
 			return _data[row][col];
+		}
 	}
 	return QVariant();
 }
 
 QVariant AsyncQueryResult::value(int row, const QString &col) const
 {
-	int colid = _record.indexOf(col);
-	return value(row, colid);
+	return value(row, columnIndex(col));
+}
+
+int AsyncQueryResult::columnIndex(const QString &col) const
+{
+	QHash<QString, int>::const_iterator it = _colIndex.constFind(col);
+	if (it != _colIndex.constEnd()) {
+		return it.value();
+	}
+	return _record.indexOf(col);
+}
+
+void AsyncQueryResult::setRecord(const QSqlRecord &record)
+{
+	_record = record;
+	_colIndex.clear();
+	_colIndex.reserve(_record.count());
+	for (int i = 0; i < _record.count(); i++) {
+		//first column wins, same as QSqlRecord::indexOf()
+		const QString name = _record.fieldName(i);
+		if (!_colIndex.contains(name)) {
+			_colIndex.insert(name, i);
+		}
+	}
+}
+
+QVector<QVector<QVariant>> AsyncQueryResult::data() const
+{
+	if (!_store) {
+		return _data;
+	}
+	QVector<QVector<QVariant>> ret;
+	ret.reserve(_store->count());
+	for (int row = 0; row < _store->count(); row++) {
+		ret.append(_store->row(row));
+	}
+	return ret;
+}
+
+bool AsyncQueryResult::isSpilled() const
+{
+	return !_store.isNull();
+}
+
+bool AsyncQueryResult::save(QIODevice *device) const
+{
+	ResultFileWriter writer(device);
+	if (!writer.writeHeader(_record, _error)) {
+		return false;
+	}
+	for (int row = 0; row < count(); row++) {
+		if (!writer.writeRow(_store ? _store->row(row) : _data.at(row))) {
+			return false;
+		}
+	}
+	return writer.finish();
+}
+
+bool AsyncQueryResult::save(const QString &fileName) const
+{
+	QSaveFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	if (!save(&file)) {
+		file.cancelWriting();
+		return false;
+	}
+	return file.commit();
+}
+
+AsyncQueryResult AsyncQueryResult::load(const QString &fileName, bool *ok)
+{
+	AsyncQueryResult res;
+	ResultFileReader reader;
+	bool succ = reader.openFile(fileName);
+	if (succ) {
+		res.setRecord(reader.record());
+		res._error = reader.error();
+		res._store = reader.store();
+	}
+	if (ok != nullptr) {
+		*ok = succ;
+	}
+	return res;
+}
+
+AsyncQueryResult AsyncQueryResult::fromData(const QByteArray &data, bool *ok)
+{
+	AsyncQueryResult res;
+	ResultFileReader reader;
+	bool succ = reader.openData(data);
+	if (succ) {
+		res.setRecord(reader.record());
+		res._error = reader.error();
+		res._store = reader.store();
+	}
+	if (ok != nullptr) {
+		*ok = succ;
+	}
+	return res;
 }
 
 bool AsyncQueryResult::isValid() const
 {
 	return !_error.isValid();
 }
+
+QDataStream &operator<<(QDataStream &out, const AsyncQueryResult &result)
+{
+	QBuffer buffer;
+	buffer.open(QIODevice::WriteOnly);
+	result.save(&buffer);
+	out << buffer.data();
+	return out;
+}
+
+QDataStream &operator>>(QDataStream &in, AsyncQueryResult &result)
+{
+	QByteArray data;
+	in >> data;
+	bool ok = false;
+	result = AsyncQueryResult::fromData(data, &ok);
+	if (!ok) {
+		in.setStatus(QDataStream::ReadCorruptData);
+	}
+	return in;
+}
 }	//	namespace
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <QMetaType>
+#include <QDataStream>
+#include <QHash>
+#include <QSharedPointer>
 #include <QSqlRecord>
 #include <QVector>
 #include <QVariant>
@@ -11,6 +14,9 @@ namespace Database {
 
 // class forward decls's
 class SqlTaskPrivate;
+class ResultBuilder;
+class ResultMemoryToken;
+class ResultStore;
 
 /**
 * @brief Represent a AsyncQuery result.
@@ -18,12 +24,69 @@ class SqlTaskPrivate;
 * occured AsyncQueryResult is not isValid() and the error can retrieved with
 * error().
 *
+* Large results may be spilled to a memory mapped file while fetching (see
+* AsyncQuery::setMemoryLimit()). The getter functions read such results lazily.
+*
+* Results can be persisted with save() and reloaded with load() in the binary format
+* described in ResultFile.
+*
 */
 class AsyncQueryResult
 {
 friend class SqlTaskPrivate;
+friend class ResultBuilder;
 
 public:
+	/**
+	 * @brief Lightweight, non-owning view on one row of a result.
+	 * @details A RowView does not copy any data, it only refers to the result it was
+	 * created from and therefore must not outlive it. Column access by name uses the
+	 * precomputed column index of the result.
+	 */
+	class RowView
+	{
+	public:
+		RowView(const AsyncQueryResult *res, int row) : _res(res), _row(row) {}
+
+		/** @brief Row number of the view within the result. */
+		int row() const { return _row; }
+		/** @brief Number of columns. */
+		int count() const { return _res->_record.count(); }
+
+		QVariant value(int col) const { return _res->value(_row, col); }
+		QVariant value(const QString &col) const { return _res->value(_row, col); }
+		QVariant operator[](int col) const { return value(col); }
+		QVariant operator[](const QString &col) const { return value(col); }
+
+	private:
+		const AsyncQueryResult *_res;
+		int _row;
+	};
+
+	/**
+	 * @brief Forward iterator over the rows of a result, dereferences to a RowView.
+	 * @details Sample Usage:
+	 * \code{.cpp}
+	 * for (const Database::AsyncQueryResult::RowView &row : result) {
+	 *     qDebug() << row["CompanyName"].toString();
+	 * }
+	 * \endcode
+	 */
+	class const_iterator
+	{
+	public:
+		const_iterator(const AsyncQueryResult *res, int row) : _res(res), _row(row) {}
+
+		RowView operator*() const { return RowView(_res, _row); }
+		const_iterator &operator++() { _row++; return *this; }
+		bool operator==(const const_iterator &other) const { return _row == other._row; }
+		bool operator!=(const const_iterator &other) const { return _row != other._row; }
+
+	private:
+		const AsyncQueryResult *_res;
+		int _row;
+	};
+
 	AsyncQueryResult();
 	virtual ~AsyncQueryResult();
 	AsyncQueryResult(const AsyncQueryResult&);
@@ -51,9 +114,26 @@ public:
 
 	/**
 	 * @brief Returns the QSqlRecord of given row.
+	 * @note A complete QSqlRecord is built on each call. Use row() to access the
+	 * values of a row without copying.
 	 */
 	QSqlRecord record(int row) const;
 
+	/**
+	 * @brief Returns a non-owning view on given row.
+	 */
+	RowView row(int row) const { return RowView(this, row); }
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, count()); }
+
+	/**
+	 * @brief Returns the index of the column with given name or -1 if not found.
+	 * @details The lookup uses a hash built once per result. Names not found in the
+	 * hash are resolved with QSqlRecord::indexOf().
+	 */
+	int columnIndex(const QString &col) const;
+
 	/**
 	 * @brief Returns the value of given row and columns.
 	 * @details If row or col is invalid a empty QVariatn is returned.
@@ -68,15 +148,87 @@ public:
 
 	/**
 	 * @brief Returns internal raw data structure of result.
+	 * @note If the result is spilled all rows are read into memory.
+	 */
+	QVector<QVector<QVariant>> data() const;
+
+	/**
+	 * @brief Returns \c true if the rows are stored in a memory mapped file.
+	 */
+	bool isSpilled() const;
+
+	/**
+	 * @brief Writes the result in the binary format described in ResultFile.
+	 * @note The device has to be opened for writing.
 	 */
-	QVector<QVector<QVariant>> data() const { return _data; }
+	bool save(QIODevice *device) const;
+
+	/**
+	 * @brief Writes the result to a file in the binary format described in ResultFile.
+	 */
+	bool save(const QString &fileName) const;
+
+	/**
+	 * @brief Loads a result written with save().
+	 * @details The file is memory mapped, only the header and the row index are read.
+	 * Values are decoded on access.
+	 */
+	static AsyncQueryResult load(const QString &fileName, bool *ok = nullptr);
+
+	/**
+	 * @brief Loads a result from a buffer written with save().
+	 */
+	static AsyncQueryResult fromData(const QByteArray &data, bool *ok = nullptr);
+
+	/**
+	 * @brief Number of times the query was retried after transient errors.
+	 * @see AsyncQuery::setRetryPolicy()
+	 */
+	int retryCount() const;
+
+	/**
+	 * @brief The tag of the AsyncQuery when the query was started.
+	 * @see AsyncQuery::setTag()
+	 */
+	QVariant tag() const;
+
+	/**
+	 * @brief Share of string values which were deduplicated while fetching, e.g. 0.9
+	 * if 90 percent of the values share the string of another row. 0 if strings were
+	 * not interned.
+	 * @see AsyncQuery::setInternStrings()
+	 */
+	double dedupRatio() const;
+
+	/**
+	 * @brief Estimated number of bytes the rows occupy in memory, shared by all
+	 * copies of the result. 0 for spilled and loaded results.
+	 * @see ResultMemory
+	 */
+	qint64 memoryUsage() const;
+
+private:
+	/* sets the head record and builds the column index */
+	void setRecord(const QSqlRecord &record);
 
 private:
 	QVector<QVector<QVariant>> _data;
 	QSqlRecord _record;
+	QHash<QString, int> _colIndex;
 	QSqlError _error;
+	QSharedPointer<const ResultStore> _store;
+	int _retryCount;
+	QVariant _tag;
+	double _dedupRatio;
+	QSharedPointer<const ResultMemoryToken> _memory;
 };
 
+/** @name Convenience QDataStream operators using the binary format of save(). */
+///@{
+QDataStream &operator<<(QDataStream &out, const AsyncQueryResult &result);
+QDataStream &operator>>(QDataStream &in, AsyncQueryResult &result);
+///@}
+
 }	//	namespace
 
 Q_DECLARE_METATYPE(Database::AsyncQueryResult)
@@ -1,23 +1,264 @@
 #include "AsynqQueryModel.h"
 
 #include "AsyncQuery.h"
+#include "ConnectionManager.h"
+#include "SqlStatement.h"
+
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtNumeric>
+
+#include <algorithm>
 
 
 namespace Database {
 
+/* shared between the model and its background tasks, the model pointer is reset
+ * when the model is destroyed */
+struct ModelTokenPrivate {
+	QMutex mutex;
+	AsyncQueryModel *model;
+};
+
+namespace {
+
+/* pages fetched at the same time in paged mode */
+const int kMaxLoadingPages = 4;
+
+/* delay before a failed page is requested again, doubled with each failure */
+const int kPageRetryMs = 1000;
+const int kMaxPageRetryMs = 30000;
+
+/* strips trailing semicolons, so the query can be used as sub query */
+QString subQuery(const QString &query)
+{
+	QString ret = query.trimmed();
+	while (ret.endsWith(';')) {
+		ret.chop(1);
+		ret = ret.trimmed();
+	}
+	return ret;
+}
+
+bool isNumeric(const QVariant &val)
+{
+	switch (val.type()) {
+	case QVariant::Bool:
+	case QVariant::Int:
+	case QVariant::UInt:
+	case QVariant::LongLong:
+	case QVariant::ULongLong:
+	case QVariant::Double:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* sort classes, values of different classes never compare by value */
+typedef enum SortClass {
+	Sort_Null = 0,
+	Sort_Numeric,
+	Sort_Text,
+	Sort_Date,
+	Sort_Time,
+	Sort_DateTime,
+	Sort_Other,
+} SortClass;
+
+SortClass sortClass(const QVariant &v)
+{
+	if (v.isNull()) {
+		return Sort_Null;
+	}
+	if (isNumeric(v)) {
+		return Sort_Numeric;
+	}
+	switch (v.type()) {
+	case QVariant::String:
+	case QVariant::ByteArray:
+		return Sort_Text;
+	case QVariant::Date:
+		return Sort_Date;
+	case QVariant::Time:
+		return Sort_Time;
+	case QVariant::DateTime:
+		return Sort_DateTime;
+	default:
+		return Sort_Other;
+	}
+}
+
+/* orders by sort class first: NULL < numbers < text < dates, times, timestamps < others,
+ * numbers and dates by value within their class, everything else as string */
+int compareValues(const QVariant &a, const QVariant &b)
+{
+	const SortClass ca = sortClass(a);
+	const SortClass cb = sortClass(b);
+	if (ca != cb) {
+		return (ca < cb) ? -1 : 1;
+	}
+
+	switch (ca) {
+	case Sort_Null:
+		return 0;
+	case Sort_Numeric: {
+		if (a.type() == QVariant::Double || b.type() == QVariant::Double) {
+			double da = a.toDouble();
+			double db = b.toDouble();
+			//NaN is unordered, sort it before all other numbers
+			if (qIsNaN(da) || qIsNaN(db)) {
+				return int(!qIsNaN(da)) - int(!qIsNaN(db));
+			}
+			return (da < db) ? -1 : (db < da) ? 1 : 0;
+		}
+		qlonglong la = a.toLongLong();
+		qlonglong lb = b.toLongLong();
+		return (la < lb) ? -1 : (lb < la) ? 1 : 0;
+	}
+	case Sort_Date:
+		return (a.toDate() < b.toDate()) ? -1 : (b.toDate() < a.toDate()) ? 1 : 0;
+	case Sort_Time:
+		return (a.toTime() < b.toTime()) ? -1 : (b.toTime() < a.toTime()) ? 1 : 0;
+	case Sort_DateTime:
+		return (a.toDateTime() < b.toDateTime()) ? -1 :
+			   (b.toDateTime() < a.toDateTime()) ? 1 : 0;
+	default:
+		return QString::localeAwareCompare(a.toString(), b.toString());
+	}
+}
+
+/* builds the filtered and sorted permutation of a result */
+class ModelRowsTaskPrivate : public QRunnable
+{
+public:
+	ModelRowsTaskPrivate(const QSharedPointer<ModelTokenPrivate> &token, int generation,
+						 const AsyncQueryResult &res, int sortColumn,
+						 Qt::SortOrder sortOrder, const QString &filterText,
+						 int filterColumn)
+		: _token(token)
+		, _generation(generation)
+		, _res(res)
+		, _sortColumn(sortColumn)
+		, _sortOrder(sortOrder)
+		, _filterText(filterText)
+		, _filterColumn(filterColumn)
+	{
+	}
+
+	void run() override
+	{
+		const int count = _res.count();
+		const int columns = _res.headRecord().count();
+		QVector<int> rows;
+		rows.reserve(count);
+
+		for (int ii = 0; ii < count; ii++) {
+			if (_filterText.isEmpty() || matches(ii, columns)) {
+				rows.append(ii);
+			}
+		}
+
+		if (_sortColumn >= 0 && _sortColumn < columns) {
+			//fetch the keys once, values of spilled results are decoded on access
+			QVector<QVariant> keys(count);
+			for (int ii = 0; ii < rows.size(); ii++) {
+				keys[rows.at(ii)] = _res.value(rows.at(ii), _sortColumn);
+			}
+			const bool desc = (_sortOrder == Qt::DescendingOrder);
+			std::stable_sort(rows.begin(), rows.end(), [&keys, desc](int a, int b) {
+				int cmp = compareValues(keys.at(a), keys.at(b));
+				return desc ? (cmp > 0) : (cmp < 0);
+			});
+		}
+
+		QMutexLocker locker(&_token->mutex);
+		if (_token->model != nullptr) {
+			QMetaObject::invokeMethod(_token->model, "onRowsDone", Qt::QueuedConnection,
+									  Q_ARG(int, _generation),
+									  Q_ARG(QVector<int>, rows));
+		}
+	}
+
+private:
+	bool matches(int row, int columns) const
+	{
+		if (_filterColumn >= 0) {
+			return _res.value(row, _filterColumn).toString()
+				.contains(_filterText, Qt::CaseInsensitive);
+		}
+		for (int ii = 0; ii < columns; ii++) {
+			if (_res.value(row, ii).toString().contains(_filterText, Qt::CaseInsensitive)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	QSharedPointer<ModelTokenPrivate> _token;
+	int _generation;
+	AsyncQueryResult _res;
+	int _sortColumn;
+	Qt::SortOrder _sortOrder;
+	QString _filterText;
+	int _filterColumn;
+};
+
+}
+
 
 AsyncQueryModel::AsyncQueryModel(QObject* parent)
 	: QAbstractTableModel(parent)
 	, logger("Database.AsyncQuerModel")
+	, _token(new ModelTokenPrivate)
+	, _generation(0)
+	, _sortColumn(-1)
+	, _sortOrder(Qt::AscendingOrder)
+	, _filterColumn(-1)
+	, _shownFilterColumn(-1)
+	, _permuted(false)
+	, _autoRefresh(false)
+	, _paged(false)
+	, _pageSize(256)
+	, _maxPages(16)
+	, _pageGeneration(0)
+	, _pageRows(0)
+	, _pendingRows(-1)
+	, _hasPendingRecord(false)
+	, _pagesShown(false)
+	, _placeholder(QString("..."))
+	, _loadScheduled(false)
 {
+	qRegisterMetaType<QVector<int> >("QVector<int>");
+	_token->model = this;
+
 	_aQuery = new AsyncQuery(this);
+	//the result replaces _res, holding it back would not free memory
+	_aQuery->setResultBudgetExempt(true);
 	connect (_aQuery, SIGNAL(execDone(Database::AsyncQueryResult)),
 			 this, SLOT(onExecDone(Database::AsyncQueryResult)));
+	connect (_aQuery, SIGNAL(execDoneBatch(QList<Database::AsyncQueryResult>)),
+			 this, SLOT(onExecDoneBatch(QList<Database::AsyncQueryResult>)));
+
+	_refreshTimer = new QTimer(this);
+	_refreshTimer->setSingleShot(true);
+	_refreshTimer->setInterval(200);
+	connect (_refreshTimer, SIGNAL(timeout()), this, SLOT(onRefreshTimeout()));
+
+	_pageQuery = new AsyncQuery(this);
+	//the page cache is bounded by maxPages
+	_pageQuery->setResultBudgetExempt(true);
+	connect (_pageQuery, SIGNAL(execDone(Database::AsyncQueryResult)),
+			 this, SLOT(onPageDone(Database::AsyncQueryResult)));
 }
 
 AsyncQueryModel::~AsyncQueryModel()
 {
-
+	//running tasks must not deliver to this model anymore
+	QMutexLocker locker(&_token->mutex);
+	_token->model = nullptr;
 }
 
 AsyncQuery *AsyncQueryModel::asyncQuery() const
@@ -25,29 +266,166 @@ AsyncQuery *AsyncQueryModel::asyncQuery() const
 	return _aQuery;
 }
 
-void AsyncQueryModel::startExec(const QString &query)
+bool AsyncQueryModel::startExec(const QString &query)
+{
+	return _aQuery->startExec(query);
+}
+
+bool AsyncQueryModel::startExecPaged(const QString &query, int pageSize, int maxPages)
+{
+	if (!_paged) {
+		//the full result is not needed anymore
+		beginResetModel();
+		_paged = true;
+		_res = AsyncQueryResult();
+		_generation++;
+		_permuted = false;
+		_rows.clear();
+		_pageRows = 0;
+		_pageRecord = QSqlRecord();
+		endResetModel();
+	}
+
+	//the shown rows stay until the count and the first page of the query arrived
+	clearPages();
+	_pagedQuery = subQuery(query);
+	_pageSize = qMax(1, pageSize);
+	_maxPages = qMax(1, maxPages);
+
+	_pageQuery->setTag(QVariantList() << _pageGeneration << -1);
+	if (!_pageQuery->startExec(QString("SELECT COUNT(*) FROM (%1) AS aq_count")
+							   .arg(_pagedQuery))) {
+		return false;
+	}
+	requestPage(0);
+	return true;
+}
+
+bool AsyncQueryModel::isPaged() const
+{
+	return _paged;
+}
+
+QSqlError AsyncQueryModel::lastPageError() const
+{
+	return _pageError;
+}
+
+void AsyncQueryModel::setPlaceholder(const QVariant &placeholder)
+{
+	_placeholder = placeholder;
+}
+
+QVariant AsyncQueryModel::placeholder() const
+{
+	return _placeholder;
+}
+
+void AsyncQueryModel::setFilter(const QString &text, int column)
+{
+	_filterText = text;
+	_filterColumn = column;
+	startRows();
+}
+
+QString AsyncQueryModel::filterText() const
+{
+	return _filterText;
+}
+
+int AsyncQueryModel::filterColumn() const
+{
+	return _filterColumn;
+}
+
+int AsyncQueryModel::sortColumn() const
+{
+	return _sortColumn;
+}
+
+Qt::SortOrder AsyncQueryModel::sortOrder() const
+{
+	return _sortOrder;
+}
+
+int AsyncQueryModel::sourceRow(int row) const
+{
+	if (_paged) {
+		return row;
+	}
+	return _permuted ? _rows.at(row) : row;
+}
+
+void AsyncQueryModel::setAutoRefresh(bool enable)
+{
+	if (enable == _autoRefresh) {
+		return;
+	}
+	_autoRefresh = enable;
+
+	ConnectionManager *conmgr = ConnectionManager::instance();
+	if (enable) {
+		connect (conmgr, SIGNAL(tablesChanged(QStringList)),
+				 this, SLOT(onTablesChanged(QStringList)));
+	} else {
+		disconnect (conmgr, SIGNAL(tablesChanged(QStringList)),
+					this, SLOT(onTablesChanged(QStringList)));
+		_refreshTimer->stop();
+	}
+}
+
+bool AsyncQueryModel::autoRefresh() const
 {
-	_aQuery->startExec(query);
+	return _autoRefresh;
+}
+
+void AsyncQueryModel::setRefreshDebounceMs(int ms)
+{
+	_refreshTimer->setInterval(ms);
+}
+
+int AsyncQueryModel::refreshDebounceMs() const
+{
+	return _refreshTimer->interval();
 }
 
 int AsyncQueryModel::rowCount(const QModelIndex &parent) const
 {
 	Q_UNUSED(parent);
-	return _res.count();
+	if (_paged) {
+		return _pageRows;
+	}
+	return _permuted ? _rows.size() : _res.count();
 
 }
 
 int AsyncQueryModel::columnCount(const QModelIndex &parent) const
 {
 	Q_UNUSED(parent);
-	return _res.headRecord().count();
+	return _paged ? _pageRecord.count() : _res.headRecord().count();
 }
 
 QVariant AsyncQueryModel::data(const QModelIndex &index, int role) const
 {
+	if (role == Qt::DisplayRole && _paged)
+	{
+		int page = index.row() / _pageSize;
+		QHash<int, AsyncQueryResult>::const_iterator it = _pages.constFind(page);
+		if (it == _pages.constEnd()) {
+			if (_failedPages.contains(page)) {
+				return QVariant();
+			}
+			if (!_loading.contains(page)) {
+				requestPage(page);
+			}
+			return _placeholder;
+		}
+		touchPage(page);
+		return it.value().value(index.row() - page * _pageSize, index.column());
+	}
 	if (role == Qt::DisplayRole)
 	{
-		return _res.value(index.row(), index.column());
+		return _res.value(sourceRow(index.row()), index.column());
 	}
 	return QVariant();
 
@@ -58,12 +436,22 @@ QVariant AsyncQueryModel::headerData(int section,
 {
 	if (role == Qt::DisplayRole) {
 		if (orientation == Qt::Horizontal) {
+			if (_paged) {
+				return _pageRecord.fieldName(section);
+			}
 			return _res.headRecord().fieldName(section);
 		}
 	}
 	return QVariant();
 }
 
+void AsyncQueryModel::sort(int column, Qt::SortOrder order)
+{
+	_sortColumn = column;
+	_sortOrder = order;
+	startRows();
+}
+
 void AsyncQueryModel::onExecDone(const Database::AsyncQueryResult &result)
 {
 	if (!result.isValid()) {
@@ -71,8 +459,265 @@ void AsyncQueryModel::onExecDone(const Database::AsyncQueryResult &result)
 	}
 
 	beginResetModel();
+	if (_paged) {
+		_paged = false;
+		clearPages();
+		_pageRows = 0;
+		_pageRecord = QSqlRecord();
+	}
 	_res = result;
+	_generation++;
+	_permuted = false;
+	_rows.clear();
+	_shownFilterText.clear();
+	_shownFilterColumn = -1;
 	endResetModel();
+
+	startRows();
+}
+
+void AsyncQueryModel::onExecDoneBatch(const QList<Database::AsyncQueryResult> &results)
+{
+	//only the latest result is shown
+	if (!results.isEmpty()) {
+		onExecDone(results.last());
+	}
+}
+
+void AsyncQueryModel::onRowsDone(int generation, const QVector<int> &rows)
+{
+	//result, sort or filter changed meanwhile
+	if (generation != _generation) {
+		return;
+	}
+	applyRows(true, rows);
+}
+
+void AsyncQueryModel::startRows()
+{
+	_generation++;
+	if (_paged) {
+		return;
+	}
+	if (_sortColumn < 0 && _filterText.isEmpty()) {
+		if (_permuted) {
+			applyRows(false, QVector<int>());
+		}
+		return;
+	}
+	QThreadPool::globalInstance()->start(
+		new ModelRowsTaskPrivate(_token, _generation, _res, _sortColumn, _sortOrder,
+								 _filterText, _filterColumn));
+}
+
+void AsyncQueryModel::applyRows(bool permuted, const QVector<int> &rows)
+{
+	//same rows in a new order, keep the persistent indexes (selection, current)
+	if (_shownFilterText == _filterText && _shownFilterColumn == _filterColumn) {
+		emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(),
+									QAbstractItemModel::VerticalSortHint);
+		QModelIndexList from = persistentIndexList();
+		QVector<int> source(from.size());
+		for (int ii = 0; ii < from.size(); ii++) {
+			source[ii] = sourceRow(from.at(ii).row());
+		}
+
+		_permuted = permuted;
+		_rows = rows;
+
+		QVector<int> inverse(_res.count(), -1);
+		for (int ii = 0; ii < rowCount(QModelIndex()); ii++) {
+			inverse[sourceRow(ii)] = ii;
+		}
+		QModelIndexList to;
+		to.reserve(from.size());
+		for (int ii = 0; ii < from.size(); ii++) {
+			int row = inverse.at(source.at(ii));
+			to.append(row < 0 ? QModelIndex() : index(row, from.at(ii).column()));
+		}
+		changePersistentIndexList(from, to);
+		emit layoutChanged(QList<QPersistentModelIndex>(),
+						   QAbstractItemModel::VerticalSortHint);
+		return;
+	}
+
+	beginResetModel();
+	_permuted = permuted;
+	_rows = rows;
+	_shownFilterText = _filterText;
+	_shownFilterColumn = _filterColumn;
+	endResetModel();
+}
+
+
+void AsyncQueryModel::onTablesChanged(const QStringList &tables)
+{
+	//the timer is not restarted, so steady changes still refresh the model
+	if (!_autoRefresh || _refreshTimer->isActive()) {
+		return;
+	}
+
+	QString query = _paged ? _pagedQuery : _aQuery->lastQuery();
+	if (query.isEmpty() || !SqlStatement::isReadOnly(query)) {
+		return;
+	}
+
+	QStringList read = SqlStatement::tables(query);
+	for (int ii = 0; ii < tables.size(); ii++) {
+		if (read.contains(tables.at(ii))) {
+			_refreshTimer->start();
+			return;
+		}
+	}
+}
+
+void AsyncQueryModel::onRefreshTimeout()
+{
+	if (_paged) {
+		qCDebug(logger) << "Refresh" << _pagedQuery;
+		startExecPaged(_pagedQuery, _pageSize, _maxPages);
+		return;
+	}
+	qCDebug(logger) << "Refresh" << _aQuery->lastQuery();
+	_aQuery->restartExec();
+}
+
+void AsyncQueryModel::onPageDone(const Database::AsyncQueryResult &result)
+{
+	//tag is [generation, page], page -1 is the count query
+	QVariantList tag = result.tag().toList();
+	if (tag.size() != 2 || tag.at(0).toInt() != _pageGeneration) {
+		return;
+	}
+	int page = tag.at(1).toInt();
+	if (!result.isValid()) {
+		qCDebug(logger) << "SqlError" << result.error().text();
+		_pageError = result.error();
+		if (page < 0) {
+			//the number of rows is unknown, the rows shown before stay
+			_wanted.clear();
+		} else {
+			//not cached, the page is requested again after the delay or on a refresh
+			_loading.remove(page);
+			int failures = ++_pageFailures[page];
+			_failedPages.insert(page);
+			int delay = qMin(kPageRetryMs << qMin(failures - 1, 5), kMaxPageRetryMs);
+			int generation = _pageGeneration;
+			QTimer::singleShot(delay, this, [this, generation, page]() {
+				retryPage(generation, page);
+			});
+			emitPageChanged(page);
+			loadPages();
+		}
+		emit pageError(_pageError);
+		return;
+	}
+
+	if (page < 0) {
+		_pendingRows = (result.count() > 0) ? result.value(0, 0).toInt() : 0;
+	} else {
+		_loading.remove(page);
+		_pageFailures.remove(page);
+		_pages.insert(page, result);
+		touchPage(page);
+		while (_lru.size() > _maxPages) {
+			_pages.remove(_lru.takeFirst());
+		}
+		if (page == 0 && !_pagesShown) {
+			_pendingRecord = result.headRecord();
+			_hasPendingRecord = true;
+		}
+		emitPageChanged(page);
+	}
+
+	if (!_pagesShown && _pendingRows >= 0 && _hasPendingRecord) {
+		beginResetModel();
+		_pageRows = _pendingRows;
+		_pageRecord = _pendingRecord;
+		_pagesShown = true;
+		endResetModel();
+	}
+	loadPages();
+}
+
+void AsyncQueryModel::clearPages()
+{
+	//results of older generations are dropped
+	_pageGeneration++;
+	_pages.clear();
+	_lru.clear();
+	_loading.clear();
+	_wanted.clear();
+	_pendingRows = -1;
+	_pendingRecord = QSqlRecord();
+	_hasPendingRecord = false;
+	_pagesShown = false;
+	_pageFailures.clear();
+	_failedPages.clear();
+	_pageError = QSqlError();
+}
+
+void AsyncQueryModel::requestPage(int page) const
+{
+	//the most recently requested pages are loaded first
+	_wanted.removeOne(page);
+	_wanted.append(page);
+	while (_wanted.size() > _maxPages) {
+		_wanted.removeFirst();
+	}
+	//data() must not start queries, all pages requested meanwhile are started at once
+	if (!_loadScheduled) {
+		_loadScheduled = true;
+		QMetaObject::invokeMethod(const_cast<AsyncQueryModel*>(this), "loadPages",
+								  Qt::QueuedConnection);
+	}
+}
+
+void AsyncQueryModel::loadPages()
+{
+	_loadScheduled = false;
+	while (_loading.size() < kMaxLoadingPages && !_wanted.isEmpty()) {
+		int page = _wanted.takeLast();
+		if (_pages.contains(page) || _loading.contains(page)) {
+			continue;
+		}
+		_pageQuery->setTag(QVariantList() << _pageGeneration << page);
+		bool succ = _pageQuery->startExec(
+			QString("SELECT * FROM (%1) AS aq_page LIMIT %2 OFFSET %3")
+				.arg(_pagedQuery).arg(_pageSize).arg(qint64(page) * _pageSize));
+		if (!succ) {
+			//rejected by the admission control, retried when a page arrives or is requested
+			_wanted.append(page);
+			break;
+		}
+		_loading.insert(page);
+	}
+}
+
+void AsyncQueryModel::touchPage(int page) const
+{
+	if (_lru.isEmpty() || _lru.last() != page) {
+		_lru.removeOne(page);
+		_lru.append(page);
+	}
+}
+
+void AsyncQueryModel::emitPageChanged(int page)
+{
+	int first = page * _pageSize;
+	int last = qMin(first + _pageSize, _pageRows) - 1;
+	if (first <= last && _pageRecord.count() > 0) {
+		emit dataChanged(index(first, 0), index(last, _pageRecord.count() - 1));
+	}
+}
+
+void AsyncQueryModel::retryPage(int generation, int page)
+{
+	if (generation != _pageGeneration || !_failedPages.remove(page)) {
+		return;
+	}
+	//the view asks for the rows again if they are still shown
+	emitPageChanged(page);
 }
 
 }
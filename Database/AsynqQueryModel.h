@@ -2,17 +2,35 @@
 
 #include <QLoggingCategory>
 #include <QAbstractTableModel>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QSharedPointer>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
 
 #include "AsyncQueryResult.h"
 
 namespace Database {
 
 class AsyncQuery;
+struct ModelTokenPrivate;
 
 /**
  * @brief The AsyncQueryModel class implementents a QtAbstractTableModel for asynchronous
  * queries.
  * @details The model can used with a QTableView to show the query results.
+ *
+ * Sorting and filtering are done natively by the model: a permutation of the rows of
+ * the current result is built in the global thread pool and swapped in when ready, so
+ * large results can be sorted interactively without blocking the GUI thread. Use
+ * sourceRow() to map a model row to the row of the result.
+ *
+ * In paged mode (see startExecPaged()) the model holds only a window of pages of the
+ * result, so huge tables can be shown with bounded memory.
  */
 class AsyncQueryModel : public QAbstractTableModel
 {
@@ -30,8 +48,74 @@ public:
 	/**
 	 * @brief Convinience function to start the an query. The model will be updated
 	 * when finsihed.
+	 * @returns \c false if the query was rejected by the admission control.
 	 */
-	void startExec(const QString &query);
+	bool startExec(const QString &query);
+
+	/**
+	 * @brief Shows the result of query in paged mode.
+	 * @details The number of rows is determined with a count query, the rows are
+	 * fetched asynchronously in pages of pageSize rows when data() asks for them. Only
+	 * the maxPages recently used pages are kept, rows of pages which are not loaded yet
+	 * show the placeholder(). The query should have an ORDER BY clause, otherwise the
+	 * pages are not stable. Sorting and filtering are not available in paged mode,
+	 * any other startExec() leaves it.
+	 *
+	 * If the count query fails the rows shown before are kept. Rows of a page which
+	 * failed to load are empty, the page is requested again after a delay which grows
+	 * with each failure, or on the next startExecPaged(). Both emit pageError().
+	 * @returns \c false if the count query was rejected by the admission control.
+	 */
+	bool startExecPaged(const QString &query, int pageSize = 256, int maxPages = 16);
+	bool isPaged() const;
+
+	/**
+	 * @brief Error of the last failed query in paged mode, reset by startExecPaged().
+	 */
+	QSqlError lastPageError() const;
+
+	/**
+	 * @brief Value shown for rows of pages which are loading. Default is "...".
+	 */
+	void setPlaceholder(const QVariant &placeholder);
+	QVariant placeholder() const;
+
+	/**
+	 * @brief Shows only rows containing text (case insensitive) in column, or in any
+	 * column if column is -1. An empty text removes the filter.
+	 * @details The filter is applied in the background and is kept for following
+	 * results.
+	 */
+	void setFilter(const QString &text, int column = -1);
+	QString filterText() const;
+	int filterColumn() const;
+
+	/**
+	 * @brief Current sort column, -1 if the rows are in the order of the result.
+	 */
+	int sortColumn() const;
+	Qt::SortOrder sortOrder() const;
+
+	/**
+	 * @brief Maps a row of the model to the row in the current result.
+	 */
+	int sourceRow(int row) const;
+
+	/**
+	 * @brief Re-runs the last query when tables it reads are changed.
+	 * @details Changes are announced by ConnectionManager::tablesChanged(), e.g. for
+	 * writes through any AsyncQuery or database notifications. Refreshes are
+	 * debounced, an idle model does not execute any query. Default is \c false.
+	 */
+	void setAutoRefresh(bool enable);
+	bool autoRefresh() const;
+
+	/**
+	 * @brief Maximum delay of a refresh after the first change, changes within the
+	 * delay cause only one refresh. Default is 200 ms.
+	 */
+	void setRefreshDebounceMs(int ms);
+	int refreshDebounceMs() const;
 
 	/** @name QAbstractItemModel interface */
 	///@{
@@ -39,15 +123,86 @@ public:
 	int columnCount(const QModelIndex &parent) const;
 	QVariant data(const QModelIndex &index, int role) const;
 	QVariant headerData(int section, Qt::Orientation orientation, int role) const;
+	/**
+	 * @brief Sorts the rows in the background. A column of -1 restores the order of
+	 * the result.
+	 */
+	void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
 	///@}
 
+signals:
+	/**
+	 * @brief Emitted when the count query or a page query failed in paged mode.
+	 */
+	void pageError(const QSqlError &error);
+
 protected slots:
 	void onExecDone(const Database::AsyncQueryResult &result);
+	void onExecDoneBatch(const QList<Database::AsyncQueryResult> &results);
+
+private slots:
+	void onRowsDone(int generation, const QVector<int> &rows);
+	void onTablesChanged(const QStringList &tables);
+	void onRefreshTimeout();
+	void onPageDone(const Database::AsyncQueryResult &result);
+	/* starts the wanted pages, queued by requestPage() */
+	void loadPages();
+
+private:
+	void startRows();
+	void applyRows(bool permuted, const QVector<int> &rows);
+	void clearPages();
+	/* marks the page as wanted, the query is started from the event loop */
+	void requestPage(int page) const;
+	void touchPage(int page) const;
+	void emitPageChanged(int page);
+	/* allows a failed page to be requested again */
+	void retryPage(int generation, int page);
 
 private:
 	QLoggingCategory logger;
 	AsyncQueryResult _res;
 	AsyncQuery *_aQuery;
+
+	//sorting and filtering
+	QSharedPointer<ModelTokenPrivate> _token;
+	int _generation;
+	int _sortColumn;
+	Qt::SortOrder _sortOrder;
+	QString _filterText;
+	int _filterColumn;
+	QString _shownFilterText;
+	int _shownFilterColumn;
+	bool _permuted;
+	QVector<int> _rows;
+
+	//auto refresh
+	bool _autoRefresh;
+	QTimer *_refreshTimer;
+
+	//paged mode, pages are requested by data() and loaded from the event loop
+	bool _paged;
+	AsyncQuery *_pageQuery;
+	QString _pagedQuery;
+	int _pageSize;
+	int _maxPages;
+	int _pageGeneration;
+	int _pageRows;
+	QSqlRecord _pageRecord;
+	int _pendingRows;
+	QSqlRecord _pendingRecord;
+	bool _hasPendingRecord;
+	bool _pagesShown;
+	QVariant _placeholder;
+	QHash<int, AsyncQueryResult> _pages;
+	mutable QList<int> _lru;
+	QSet<int> _loading;
+	mutable QList<int> _wanted;
+	mutable bool _loadScheduled;
+	/* consecutive failures of a page, and the pages waiting for their retry */
+	QHash<int, int> _pageFailures;
+	QSet<int> _failedPages;
+	QSqlError _pageError;
 };
 
 }
@@ -1,4 +1,8 @@
 #include "ConnectionManager.h"
+#include "AffinityWorker.h"
+#include "ResultMemory.h"
+#include "SchemaCatalog.h"
+#include "TaskScheduler.h"
 #include <QSqlError>
 
 
@@ -13,10 +17,28 @@ ConnectionManager::ConnectionManager(QObject* parent /*= nullptr */)
 	_port = -1;
 	_precisionPolicy = QSql::LowPrecisionDouble;
 	_type = "QMYSQL";
+	_maxWorkers = QThread::idealThreadCount();
+	_scheduler = nullptr;
+	_catalog = nullptr;
 }
 
 ConnectionManager::~ConnectionManager()
 {
+	//pending scheduled tasks are canceled, e.g. retries finish with an error
+	delete _scheduler;
+	_scheduler = nullptr;
+	delete _catalog;
+	_catalog = nullptr;
+
+	//workers close their connections on exit
+	QList<AffinityWorker*> workers;
+	_mutex.lock();
+	workers = _workers.values() + _freeWorkers;
+	_workers.clear();
+	_freeWorkers.clear();
+	_mutex.unlock();
+	qDeleteAll(workers);
+
 	closeAll();
 }
 
@@ -213,4 +235,154 @@ void ConnectionManager::closeOne(QThread* t)
 	db.close();
 }
 
+AffinityWorker *ConnectionManager::affinityWorker(const QString &group)
+{
+	QMutexLocker locker(&_mutex);
+
+	AffinityWorker *worker = _workers.value(group, nullptr);
+	if (worker != nullptr) {
+		return worker;
+	}
+
+	if (!_freeWorkers.isEmpty()) {
+		worker = _freeWorkers.takeLast();
+		_workers.insert(group, worker);
+		return worker;
+	}
+
+	if (_workers.count() < _maxWorkers) {
+		worker = new AffinityWorker(this);
+		worker->start();
+		_workers.insert(group, worker);
+		return worker;
+	}
+
+	//reassign an idle worker of another group
+	QMutableMapIterator<QString, AffinityWorker*> it(_workers);
+	while (it.hasNext()) {
+		it.next();
+		if (it.value()->isIdle()) {
+			worker = it.value();
+			it.remove();
+			_workers.insert(group, worker);
+			return worker;
+		}
+	}
+	return nullptr;
+}
+
+void ConnectionManager::releaseAffinityWorker(const QString &group)
+{
+	QMutexLocker locker(&_mutex);
+	AffinityWorker *worker = _workers.take(group);
+	if (worker != nullptr) {
+		_freeWorkers.append(worker);
+	}
+}
+
+void ConnectionManager::setMaxAffinityWorkers(int count)
+{
+	QMutexLocker locker(&_mutex);
+	_maxWorkers = count;
+}
+
+int ConnectionManager::maxAffinityWorkers() const
+{
+	QMutexLocker locker(&_mutex);
+	return _maxWorkers;
+}
+
+TaskScheduler *ConnectionManager::scheduler()
+{
+	QMutexLocker locker(&_mutex);
+	if (_scheduler == nullptr) {
+		_scheduler = new TaskScheduler();
+		_scheduler->start();
+	}
+	return _scheduler;
+}
+
+SchemaCatalog *ConnectionManager::schemaCatalog()
+{
+	QMutexLocker locker(&_mutex);
+	if (_catalog == nullptr) {
+		_catalog = new SchemaCatalog();
+		_catalog->load();
+	}
+	return _catalog;
+}
+
+void ConnectionManager::notifySchemaChanged()
+{
+	qCDebug(logger) << "Schema changed";
+	{
+		QMutexLocker locker(&_mutex);
+		if (_catalog != nullptr) {
+			_catalog->invalidate();
+		}
+	}
+	emit schemaChanged();
+}
+
+qint64 ConnectionManager::resultBytes() const
+{
+	return ResultMemory::liveBytes();
+}
+
+void ConnectionManager::setResultBudget(qint64 bytes)
+{
+	ResultMemory::setBudget(bytes);
+}
+
+qint64 ConnectionManager::resultBudget() const
+{
+	return ResultMemory::budget();
+}
+
+void ConnectionManager::notifyTablesChanged(const QStringList &tables)
+{
+	if (tables.isEmpty()) {
+		return;
+	}
+	qCDebug(logger) << "Tables changed:" << tables;
+	emit tablesChanged(tables);
+}
+
+bool ConnectionManager::subscribeToNotification(const QString &name)
+{
+	if (!connectionExists() && !open()) {
+		return false;
+	}
+
+	QSqlDriver *driver = threadConnection().driver();
+	if (!driver->hasFeature(QSqlDriver::EventNotifications)) {
+		qCWarning(logger) << "ConnectionManager::subscribeToNotification: "
+			"driver does not support notifications";
+		return false;
+	}
+
+	connect(driver, SIGNAL(notification(QString,QSqlDriver::NotificationSource,QVariant)),
+			this, SLOT(onNotification(QString,QSqlDriver::NotificationSource,QVariant)),
+			Qt::UniqueConnection);
+	return driver->subscribeToNotification(name);
+}
+
+bool ConnectionManager::unsubscribeFromNotification(const QString &name)
+{
+	QSqlDatabase db = threadConnection();
+	if (!db.isValid()) {
+		return false;
+	}
+	return db.driver()->unsubscribeFromNotification(name);
+}
+
+void ConnectionManager::onNotification(const QString &name,
+									   QSqlDriver::NotificationSource source,
+									   const QVariant &payload)
+{
+	Q_UNUSED(source);
+	Q_UNUSED(payload);
+	notifyTablesChanged(QStringList() << name.toLower());
+}
+
 }	//	namespace
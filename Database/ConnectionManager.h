@@ -7,12 +7,19 @@
 #include <QMutex>
 #include <QSql>
 #include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QStringList>
 
 #include <QLoggingCategory>
 
 
 namespace Database {
 
+// class forward decl's
+class AffinityWorker;
+class SchemaCatalog;
+class TaskScheduler;
+
 /**
  * @brief Maintains the database connection for asynchrone queries.
  *
@@ -32,6 +39,10 @@ class ConnectionManager : public QObject
 
 	/** Number if open connections. */
 	Q_PROPERTY(int connectionCount READ connectionCount NOTIFY connectionCountChanged)
+	/** Bytes held by live query results, see ResultMemory. */
+	Q_PROPERTY(qint64 resultBytes READ resultBytes)
+	/** Budget of live result bytes, 0 means no budget. */
+	Q_PROPERTY(qint64 resultBudget READ resultBudget WRITE setResultBudget)
 
 public:
 	/**
@@ -128,12 +139,114 @@ public:
 	void closeOne(QThread* t);
 	///@}
 
+	///@{
+	/**
+	  * @name Affinity workers. Basically for AsyncQuery internal usage.
+	  */
+
+	/**
+	 * @brief Returns the worker thread of given affinity group.
+	 * @details The worker is created if it does not exist. If the maximum number of
+	 * workers is reached an idle worker of another group is reassigned.
+	 * @returns nullptr if no worker is available.
+	 */
+	AffinityWorker *affinityWorker(const QString &group);
+
+	/**
+	 * @brief Removes the assignment of given affinity group. Its worker is kept
+	 * and handed to the next group that needs one.
+	 */
+	void releaseAffinityWorker(const QString &group);
+
+	/**
+	 * @brief Set the maximum number of affinity workers. Default is
+	 * QThread::idealThreadCount().
+	 */
+	void setMaxAffinityWorkers(int count);
+	int maxAffinityWorkers() const;
+
+	/**
+	 * @brief Returns the scheduler for delayed tasks, e.g. retries. It is created on
+	 * first use.
+	 */
+	TaskScheduler *scheduler();
+	///@}
+
+	///@{
+	/**
+	  * @name Schema.
+	  */
+
+	/**
+	 * @brief Returns the cached schema catalog. It is created and loaded in the
+	 * background on first use.
+	 */
+	SchemaCatalog *schemaCatalog();
+
+	/**
+	 * @brief Announces that the schema was modified, the schema catalog is reloaded.
+	 * @details Called by AsyncQuery after each successful DDL statement (see
+	 * SqlStatement::isDdl()). Call it for changes made by other means.
+	 */
+	void notifySchemaChanged();
+	///@}
+
+	///@{
+	/**
+	  * @name Result memory, see ResultMemory.
+	  */
+	qint64 resultBytes() const;
+	void setResultBudget(qint64 bytes);
+	qint64 resultBudget() const;
+	///@}
+
+	///@{
+	/**
+	  * @name Change notifications.
+	  */
+
+	/**
+	 * @brief Announces that tables were modified.
+	 * @details Called by AsyncQuery after each successful statement which writes
+	 * tables (see SqlStatement::writtenTables()). Call it for changes made by other
+	 * means, e.g. with a plain QSqlQuery.
+	 */
+	void notifyTablesChanged(const QStringList &tables);
+
+	/**
+	 * @brief Subscribes to the database event notification name on the connection of
+	 * the calling thread, which needs a running event loop (e.g. the main thread).
+	 * @details Requires a driver with QSqlDriver::EventNotifications (e.g. QPSQL,
+	 * QIBASE). Received notifications emit tablesChanged() with name as table, so the
+	 * notification should be named like the table and raised by a trigger.
+	 * @returns \c false if the driver does not support notifications.
+	 */
+	bool subscribeToNotification(const QString &name);
+	bool unsubscribeFromNotification(const QString &name);
+	///@}
+
 signals:
 	/**
 	 * @brief Is emitted if the number of connections is changed.
 	 */
 	void connectionCountChanged(int);
 
+	/**
+	 * @brief Is emitted if tables were modified, table names are in lower case.
+	 * @note Can be emitted from any thread.
+	 */
+	void tablesChanged(const QStringList &tables);
+
+	/**
+	 * @brief Is emitted if the schema was modified.
+	 * @note Can be emitted from any thread.
+	 */
+	void schemaChanged();
+
+private slots:
+	void onNotification(const QString &name, QSqlDriver::NotificationSource source,
+						const QVariant &payload);
+
 private:
 	ConnectionManager(QObject* parent = nullptr);
 	virtual ~ConnectionManager();
@@ -145,6 +258,13 @@ private:
 	mutable QMutex _mutex;
 	QMap<QThread*, QSqlDatabase> _conns;
 
+	QMap<QString, AffinityWorker*> _workers;
+	/* workers of released groups */
+	QList<AffinityWorker*> _freeWorkers;
+	int _maxWorkers;
+	TaskScheduler *_scheduler;
+	SchemaCatalog *_catalog;
+
 	QString	_hostName;
 	int	_port;
 	QString	_userName;
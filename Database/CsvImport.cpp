@@ -0,0 +1,653 @@
+#include "CsvImport.h"
+#include "ConnectionManager.h"
+#include "ResultBuilder.h"
+
+#include <QDate>
+#include <QDateTime>
+#include <QFile>
+#include <QMap>
+#include <QPair>
+#include <QRunnable>
+#include <QSharedPointer>
+#include <QSqlDriver>
+#include <QSqlField>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QThreadPool>
+#include <QTime>
+#include <QVector>
+
+namespace Database {
+
+namespace {
+
+/* whole records of the file, parsed by any thread and inserted by the writer */
+typedef struct CsvChunk {
+	QByteArray data;
+	/* number of the first record in the file */
+	qint64 firstRow;
+	QVector<QVector<QVariant>> rows;
+	QVector<qint64> rowNumbers;
+	QList<QPair<qint64, QString>> errors;
+} CsvChunk;
+
+/* shared between the writer and the parse tasks, the settings are not changed after
+ * the first chunk is queued */
+struct CsvStatePrivate {
+	QMutex mutex;
+	QWaitCondition condition;
+	char delimiter;
+	QStringList columns;
+	QVector<QVariant::Type> types;
+	/* chunks by index */
+	QMap<int, CsvChunk> raw;
+	QMap<int, CsvChunk> parsed;
+};
+
+/* takes whole records of at least minBytes from pending, less at the end of the file,
+ * count is set to the number of records */
+QByteArray takeRecords(QFile &file, QByteArray *pending, bool *eof, int minBytes,
+					   qint64 *count)
+{
+	int scanned = 0;
+	int end = 0;
+	bool quoted = false;
+	*count = 0;
+
+	forever {
+		const char *p = pending->constData();
+		for (; scanned < pending->size() && end < minBytes; scanned++) {
+			//doubled quotes toggle twice, so the state is right for RFC 4180
+			if (p[scanned] == '"') {
+				quoted = !quoted;
+			} else if (p[scanned] == '\n' && !quoted) {
+				end = scanned + 1;
+				(*count)++;
+			}
+		}
+		if (end > 0 && end >= minBytes) {
+			break;
+		}
+		if (*eof) {
+			//last record without line break
+			if (end < pending->size()) {
+				end = pending->size();
+				(*count)++;
+			}
+			break;
+		}
+		QByteArray block = file.read(qMax(minBytes, 64 * 1024));
+		if (block.isEmpty()) {
+			*eof = true;
+		}
+		pending->append(block);
+	}
+
+	QByteArray ret = pending->left(end);
+	pending->remove(0, end);
+	return ret;
+}
+
+/* reads the record at pos, returns false at the end of data */
+bool readRecord(const QByteArray &data, int *pos, char delimiter,
+				QVector<QByteArray> *fields, QVector<bool> *quoted)
+{
+	const int len = data.size();
+	const char *p = data.constData();
+	int ii = *pos;
+	if (ii >= len) {
+		return false;
+	}
+	fields->clear();
+	quoted->clear();
+
+	forever {
+		QByteArray field;
+		bool isQuoted = false;
+		if (ii < len && p[ii] == '"') {
+			isQuoted = true;
+			ii++;
+			forever {
+				int start = ii;
+				while (ii < len && p[ii] != '"') {
+					ii++;
+				}
+				field.append(p + start, ii - start);
+				if (ii + 1 < len && p[ii + 1] == '"') {
+					field.append('"');
+					ii += 2;
+					continue;
+				}
+				ii++;
+				break;
+			}
+		}
+
+		//unquoted field, or characters after the closing quote
+		int start = qMin(ii, len);
+		while (ii < len && p[ii] != delimiter && p[ii] != '\n') {
+			ii++;
+		}
+		const bool lineEnd = (ii >= len || p[ii] == '\n');
+		int end = qMin(ii, len);
+		if (lineEnd && end > start && p[end - 1] == '\r') {
+			end--;
+		}
+		field.append(p + start, end - start);
+		fields->append(field);
+		quoted->append(isQuoted);
+
+		if (lineEnd) {
+			*pos = ii + 1;
+			return true;
+		}
+		ii++;
+	}
+}
+
+bool convert(const QByteArray &text, QVariant::Type type, QVariant *out)
+{
+	bool ok = true;
+	switch (type) {
+	case QVariant::Bool: {
+		QByteArray val = text.trimmed().toLower();
+		ok = (val == "1" || val == "true" || val == "0" || val == "false");
+		*out = (val == "1" || val == "true");
+		break;
+	}
+	case QVariant::Int:
+	case QVariant::UInt:
+	case QVariant::LongLong:
+	case QVariant::ULongLong:
+		*out = text.trimmed().toLongLong(&ok);
+		break;
+	case QVariant::Double:
+		*out = text.trimmed().toDouble(&ok);
+		break;
+	case QVariant::Date: {
+		QDate date = QDate::fromString(QString::fromLatin1(text.trimmed()), Qt::ISODate);
+		ok = date.isValid();
+		*out = date;
+		break;
+	}
+	case QVariant::Time: {
+		QTime time = QTime::fromString(QString::fromLatin1(text.trimmed()), Qt::ISODate);
+		ok = time.isValid();
+		*out = time;
+		break;
+	}
+	case QVariant::DateTime: {
+		QDateTime dt = QDateTime::fromString(QString::fromLatin1(text.trimmed()),
+											 Qt::ISODate);
+		ok = dt.isValid();
+		*out = dt;
+		break;
+	}
+	case QVariant::ByteArray:
+		*out = text;
+		break;
+	default:
+		*out = QString::fromUtf8(text);
+		break;
+	}
+	return ok;
+}
+
+/* splits the records of the chunk and converts the values to the column types */
+void parseChunk(const CsvStatePrivate &state, CsvChunk *chunk)
+{
+	const int cols = state.columns.size();
+	QVector<QByteArray> fields;
+	QVector<bool> quoted;
+	qint64 row = chunk->firstRow;
+	int pos = 0;
+
+	while (readRecord(chunk->data, &pos, state.delimiter, &fields, &quoted)) {
+		const qint64 current = row++;
+		if (fields.size() == 1 && fields.at(0).isEmpty() && !quoted.at(0)) {
+			//empty line
+			continue;
+		}
+		if (fields.size() != cols) {
+			chunk->errors << qMakePair(current, QString("Expected %1 fields, found %2")
+									   .arg(cols).arg(fields.size()));
+			continue;
+		}
+
+		QVector<QVariant> values(cols);
+		bool ok = true;
+		for (int ii = 0; ii < cols && ok; ii++) {
+			//unquoted empty fields are NULL
+			if (fields.at(ii).isEmpty() && !quoted.at(ii)) {
+				continue;
+			}
+			ok = convert(fields.at(ii), state.types.at(ii), &values[ii]);
+			if (!ok) {
+				chunk->errors << qMakePair(current, QString("Column %1: invalid value '%2'")
+										   .arg(state.columns.at(ii),
+												QString::fromUtf8(fields.at(ii))));
+			}
+		}
+		if (ok) {
+			chunk->rows.append(values);
+			chunk->rowNumbers.append(current);
+		}
+	}
+	chunk->data.clear();
+}
+
+/* parses the oldest unparsed chunk */
+class CsvParseTaskPrivate : public QRunnable
+{
+public:
+	explicit CsvParseTaskPrivate(const QSharedPointer<CsvStatePrivate> &state)
+		: _state(state)
+	{
+	}
+
+	void run() override
+	{
+		QMutexLocker locker(&_state->mutex);
+		if (_state->raw.isEmpty()) {
+			//taken by the writer
+			return;
+		}
+		QMap<int, CsvChunk>::iterator it = _state->raw.begin();
+		int idx = it.key();
+		CsvChunk chunk = it.value();
+		_state->raw.erase(it);
+		locker.unlock();
+
+		parseChunk(*_state, &chunk);
+
+		locker.relock();
+		_state->parsed.insert(idx, chunk);
+		_state->condition.wakeAll();
+	}
+
+private:
+	QSharedPointer<CsvStatePrivate> _state;
+};
+
+/* returns the parsed chunk idx, parses it if no pool thread started it yet */
+CsvChunk takeParsed(CsvStatePrivate *state, int idx)
+{
+	QMutexLocker locker(&state->mutex);
+	while (!state->parsed.contains(idx)) {
+		if (state->raw.contains(idx)) {
+			CsvChunk chunk = state->raw.take(idx);
+			locker.unlock();
+			parseChunk(*state, &chunk);
+			return chunk;
+		}
+		state->condition.wait(&state->mutex);
+	}
+	return state->parsed.take(idx);
+}
+
+}
+
+/* reads the file and inserts the rows on the connection of its pool thread */
+class CsvImportTaskPrivate : public QRunnable
+{
+public:
+	CsvImportTaskPrivate(CsvImport *import, const QString &fileName)
+		: _import(import)
+		, _fileName(fileName)
+		, _table(import->_table)
+		, _columns(import->_columns)
+		, _hasHeader(import->_hasHeader)
+		, _delimiter(import->_delimiter)
+		, _batchSize(qMax(1, import->_batchSize))
+		, _chunkSize(qMax(1, import->_chunkSize))
+		, _maxErrors(import->_maxErrors)
+	{
+	}
+
+	void run() override
+	{
+		ConnectionManager* conmgr = ConnectionManager::instance();
+		if (!conmgr->connectionExists()) {
+			conmgr->open();
+		}
+
+		qint64 rows = 0;
+		qint64 errors = 0;
+		qint64 bytes = 0;
+		QSqlError error = importFile(conmgr->threadConnection(), &rows, &errors, &bytes);
+		if (rows > 0) {
+			conmgr->notifyTablesChanged(QStringList() << _table.toLower());
+		}
+
+		ResultBuilder builder;
+		builder.setRecord(CsvImport::summaryRecord());
+		builder.setError(error);
+		QVector<QVariant> row;
+		row << rows << errors << bytes;
+		builder.appendRow(row);
+
+		//the import may be destroyed afterwards
+		_import->finished(builder.result());
+	}
+
+private:
+	QSqlError importFile(QSqlDatabase db, qint64 *rows, qint64 *errors, qint64 *bytes)
+	{
+		QFile file(_fileName);
+		if (!file.open(QIODevice::ReadOnly)) {
+			return QSqlError(QString(), file.errorString(), QSqlError::UnknownError);
+		}
+		const qint64 total = file.size();
+		if (file.peek(3) == "\xEF\xBB\xBF") {
+			*bytes += file.read(3).size();
+		}
+
+		QSharedPointer<CsvStatePrivate> state(new CsvStatePrivate);
+		state->delimiter = _delimiter;
+		QByteArray pending;
+		bool eof = false;
+		qint64 nextRow = 1;
+
+		QStringList columns = _columns;
+		if (_hasHeader) {
+			qint64 count = 0;
+			QByteArray line = takeRecords(file, &pending, &eof, 1, &count);
+			nextRow += count;
+			*bytes += line.size();
+
+			QVector<QByteArray> fields;
+			QVector<bool> quoted;
+			int pos = 0;
+			if (columns.isEmpty() && readRecord(line, &pos, _delimiter, &fields, &quoted)) {
+				for (int ii = 0; ii < fields.size(); ii++) {
+					columns << QString::fromUtf8(fields.at(ii)).trimmed();
+				}
+			}
+		}
+		if (columns.isEmpty()) {
+			return QSqlError(QString(), QString("No columns"), QSqlError::UnknownError);
+		}
+
+		//the values are converted to the column types of the table
+		QSqlRecord record = db.record(_table);
+		if (record.isEmpty()) {
+			return QSqlError(QString(), QString("Table %1 not found").arg(_table),
+							 QSqlError::UnknownError);
+		}
+		QSqlDriver *driver = db.driver();
+		QStringList names;
+		QStringList marks;
+		for (int ii = 0; ii < columns.size(); ii++) {
+			int idx = record.indexOf(columns.at(ii));
+			if (idx < 0) {
+				return QSqlError(QString(), QString("Column %1 not found in %2")
+								 .arg(columns.at(ii), _table), QSqlError::UnknownError);
+			}
+			state->types << record.field(idx).type();
+			names << driver->escapeIdentifier(columns.at(ii), QSqlDriver::FieldName);
+			marks << "?";
+		}
+		state->columns = columns;
+
+		QSqlQuery insert = QSqlQuery(db);
+		if (!insert.prepare(QString("INSERT INTO %1 (%2) VALUES (%3)")
+							.arg(driver->escapeIdentifier(_table, QSqlDriver::TableName),
+								 names.join(", "), marks.join(", ")))) {
+			return insert.lastError();
+		}
+
+		QThreadPool *pool = QThreadPool::globalInstance();
+		const int maxChunks = qMax(2, pool->maxThreadCount());
+		bool transaction = driver->hasFeature(QSqlDriver::Transactions) && db.transaction();
+		qint64 batchRows = 0;
+		int nextChunk = 0;
+		int nextInsert = 0;
+		QSqlError error;
+
+		while (!error.isValid()) {
+			//read ahead, parsing runs in the pool meanwhile
+			while (!eof && nextChunk - nextInsert < maxChunks) {
+				CsvChunk chunk;
+				chunk.firstRow = nextRow;
+				qint64 count = 0;
+				chunk.data = takeRecords(file, &pending, &eof, _chunkSize, &count);
+				if (chunk.data.isEmpty()) {
+					break;
+				}
+				nextRow += count;
+				*bytes += chunk.data.size();
+
+				QMutexLocker locker(&state->mutex);
+				state->raw.insert(nextChunk++, chunk);
+				locker.unlock();
+				pool->start(new CsvParseTaskPrivate(state));
+			}
+			if (nextInsert == nextChunk) {
+				break;
+			}
+
+			CsvChunk chunk = takeParsed(state.data(), nextInsert++);
+			for (int ii = 0; ii < chunk.errors.size(); ii++) {
+				(*errors)++;
+				emit _import->rowError(chunk.errors.at(ii).first, chunk.errors.at(ii).second);
+			}
+
+			const int cols = columns.size();
+			for (int ii = 0; ii < chunk.rows.size() && !error.isValid(); ii++) {
+				const QVector<QVariant> &values = chunk.rows.at(ii);
+				for (int col = 0; col < cols; col++) {
+					insert.bindValue(col, values.at(col));
+				}
+				if (!insert.exec()) {
+					(*errors)++;
+					emit _import->rowError(chunk.rowNumbers.at(ii), insert.lastError().text());
+					continue;
+				}
+
+				if (!transaction) {
+					(*rows)++;
+				} else if (++batchRows >= _batchSize) {
+					if (!db.commit()) {
+						error = db.lastError();
+						break;
+					}
+					*rows += batchRows;
+					batchRows = 0;
+					//without a transaction the following rows would be committed one by one
+					if (!db.transaction()) {
+						error = db.lastError();
+						break;
+					}
+				}
+			}
+
+			if (_maxErrors > 0 && *errors > _maxErrors) {
+				error = QSqlError(QString(), QString("Too many errors"), QSqlError::UnknownError);
+			} else if (_import->_cancel.load() != 0) {
+				error = QSqlError(QString(), QString("Import canceled"), QSqlError::UnknownError);
+			}
+			emit _import->progress(*bytes, total, *rows + batchRows);
+		}
+
+		if (transaction) {
+			if (error.isValid()) {
+				db.rollback();
+			} else if (!db.commit()) {
+				error = db.lastError();
+			} else {
+				*rows += batchRows;
+			}
+		}
+		return error;
+	}
+
+private:
+	CsvImport *_import;
+	QString _fileName;
+	QString _table;
+	QStringList _columns;
+	bool _hasHeader;
+	char _delimiter;
+	int _batchSize;
+	int _chunkSize;
+	int _maxErrors;
+};
+
+
+CsvImport::CsvImport(QObject *parent)
+	: QObject(parent)
+	, logger("Database.CsvImport")
+	, _running(false)
+	, _cancel(0)
+	, _hasHeader(true)
+	, _delimiter(',')
+	, _batchSize(10000)
+	, _chunkSize(1024 * 1024)
+	, _maxErrors(1000)
+{
+}
+
+CsvImport::~CsvImport()
+{
+	cancel();
+	waitDone();
+}
+
+void CsvImport::setTable(const QString &table)
+{
+	QMutexLocker locker(&_mutex);
+	_table = table;
+}
+
+QString CsvImport::table() const
+{
+	QMutexLocker locker(&_mutex);
+	return _table;
+}
+
+void CsvImport::setColumns(const QStringList &columns)
+{
+	QMutexLocker locker(&_mutex);
+	_columns = columns;
+}
+
+QStringList CsvImport::columns() const
+{
+	QMutexLocker locker(&_mutex);
+	return _columns;
+}
+
+void CsvImport::setHasHeader(bool header)
+{
+	QMutexLocker locker(&_mutex);
+	_hasHeader = header;
+}
+
+bool CsvImport::hasHeader() const
+{
+	QMutexLocker locker(&_mutex);
+	return _hasHeader;
+}
+
+void CsvImport::setDelimiter(char delimiter)
+{
+	QMutexLocker locker(&_mutex);
+	_delimiter = delimiter;
+}
+
+char CsvImport::delimiter() const
+{
+	QMutexLocker locker(&_mutex);
+	return _delimiter;
+}
+
+void CsvImport::setBatchSize(int rows)
+{
+	QMutexLocker locker(&_mutex);
+	_batchSize = rows;
+}
+
+int CsvImport::batchSize() const
+{
+	QMutexLocker locker(&_mutex);
+	return _batchSize;
+}
+
+void CsvImport::setChunkSize(int bytes)
+{
+	QMutexLocker locker(&_mutex);
+	_chunkSize = bytes;
+}
+
+int CsvImport::chunkSize() const
+{
+	QMutexLocker locker(&_mutex);
+	return _chunkSize;
+}
+
+void CsvImport::setMaxErrors(int maxErrors)
+{
+	QMutexLocker locker(&_mutex);
+	_maxErrors = maxErrors;
+}
+
+int CsvImport::maxErrors() const
+{
+	QMutexLocker locker(&_mutex);
+	return _maxErrors;
+}
+
+bool CsvImport::start(const QString &fileName)
+{
+	QMutexLocker locker(&_mutex);
+	if (_running) {
+		return false;
+	}
+	_running = true;
+	_cancel.store(0);
+	qCDebug(logger) << "Import" << fileName << "into" << _table;
+	QThreadPool::globalInstance()->start(new CsvImportTaskPrivate(this, fileName));
+	return true;
+}
+
+void CsvImport::cancel()
+{
+	_cancel.store(1);
+}
+
+bool CsvImport::isRunning() const
+{
+	QMutexLocker locker(&_mutex);
+	return _running;
+}
+
+bool CsvImport::waitDone(ulong msTimeout)
+{
+	QMutexLocker locker(&_mutex);
+	while (_running) {
+		if (!_doneCondition.wait(&_mutex, msTimeout)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+QSqlRecord CsvImport::summaryRecord()
+{
+	QSqlRecord record;
+	record.append(QSqlField("Rows", QVariant::LongLong));
+	record.append(QSqlField("Errors", QVariant::LongLong));
+	record.append(QSqlField("Bytes", QVariant::LongLong));
+	return record;
+}
+
+void CsvImport::finished(const AsyncQueryResult &result)
+{
+	emit done(result);
+
+	QMutexLocker locker(&_mutex);
+	_running = false;
+	_doneCondition.wakeAll();
+}
+
+}	//	namespace
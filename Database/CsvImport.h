@@ -0,0 +1,163 @@
+#pragma once
+
+#include "AsyncQueryResult.h"
+
+#include <QAtomicInt>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+
+#include <climits>
+
+namespace Database {
+
+// class forward decl's
+class CsvImportTaskPrivate;
+
+/**
+ * @brief Imports a CSV file into a table.
+ *
+ * @details The file is read in chunks of whole records. The chunks are parsed and
+ * converted to the column types of the table in parallel in the global thread pool.
+ * One writer task inserts the rows in file order with a prepared INSERT statement on
+ * its connection and commits every batchSize() rows, so the import is limited by
+ * disk speed rather than by per row overhead.
+ *
+ * The file is parsed as RFC 4180 (UTF-8, quoted fields may contain delimiters, line
+ * breaks and doubled quotes). Unquoted empty fields are imported as NULL. Values
+ * which can not be converted to the column type and rows rejected by the database
+ * are reported with rowError() and skipped.
+ *
+ * Sample Usage:
+ * \code{.cpp}
+ * Database::CsvImport *import = new Database::CsvImport(this);
+ * import->setTable("Orders");
+ * connect (import, SIGNAL(done(Database::AsyncQueryResult)), ...);
+ * import->start("orders.csv");
+ * \endcode
+ */
+class CsvImport : public QObject
+{
+	Q_OBJECT
+
+	friend class CsvImportTaskPrivate;
+
+public:
+	explicit CsvImport(QObject *parent = nullptr);
+	/**
+	 * @brief Cancels a running import and waits until it is finished.
+	 */
+	virtual ~CsvImport();
+
+	/**
+	 * @brief The target table.
+	 */
+	void setTable(const QString &table);
+	QString table() const;
+
+	/**
+	 * @brief Target columns in the order of the fields. If empty (default) the names
+	 * of the header line are used.
+	 */
+	void setColumns(const QStringList &columns);
+	QStringList columns() const;
+
+	/**
+	 * @brief Whether the first line contains the column names. Default is \c true.
+	 */
+	void setHasHeader(bool header);
+	bool hasHeader() const;
+
+	/**
+	 * @brief Field delimiter, default is ','.
+	 */
+	void setDelimiter(char delimiter);
+	char delimiter() const;
+
+	/**
+	 * @brief Number of rows inserted per transaction. Default is 10000.
+	 */
+	void setBatchSize(int rows);
+	int batchSize() const;
+
+	/**
+	 * @brief Number of bytes parsed per task. Default is 1 MB.
+	 */
+	void setChunkSize(int bytes);
+	int chunkSize() const;
+
+	/**
+	 * @brief The import is aborted if more than maxErrors rows failed, batches
+	 * committed so far are kept. 0 means no limit. Default is 1000.
+	 */
+	void setMaxErrors(int maxErrors);
+	int maxErrors() const;
+
+	/**
+	 * @brief Starts the import of fileName in the background.
+	 * @returns \c false if an import is running already.
+	 */
+	bool start(const QString &fileName);
+
+	/**
+	 * @brief Stops the import after the current chunk, the current batch is rolled
+	 * back.
+	 */
+	void cancel();
+
+	bool isRunning() const;
+
+	/**
+	 * @brief Blocks until the import is finished.
+	 * @returns \c false on timeout.
+	 */
+	bool waitDone(ulong msTimeout = ULONG_MAX);
+
+	/**
+	 * @brief Columns of the summary result: Rows (inserted rows), Errors (failed
+	 * rows), Bytes (bytes read).
+	 */
+	static QSqlRecord summaryRecord();
+
+signals:
+	/**
+	 * @brief Is emitted after each chunk.
+	 */
+	void progress(qint64 bytesRead, qint64 bytesTotal, qint64 rows);
+
+	/**
+	 * @brief A row was skipped. row is the number of the record in the file starting
+	 * with 1, the header counts as record.
+	 */
+	void rowError(qint64 row, const QString &message);
+
+	/**
+	 * @brief Is emitted when the import is finished. The result contains one summary
+	 * row (see summaryRecord()) and the error which stopped the import, if any.
+	 */
+	void done(const Database::AsyncQueryResult &result);
+
+private:
+	/* called by the writer task */
+	void finished(const AsyncQueryResult &result);
+
+private:
+	QLoggingCategory logger;
+	mutable QMutex _mutex;
+	QWaitCondition _doneCondition;
+	bool _running;
+	QAtomicInt _cancel;
+
+	QString _table;
+	QStringList _columns;
+	bool _hasHeader;
+	char _delimiter;
+	int _batchSize;
+	int _chunkSize;
+	int _maxErrors;
+};
+
+}	//	namespace
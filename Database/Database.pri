@@ -0,0 +1,60 @@
+# Asynchronous sql library, shared by the demo application and the tools.
+# Include it with include(<path>/Database/Database.pri), headers are included as
+# "Database/AsyncQuery.h".
+
+QT += core sql
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD/..
+
+# Reads QSQLITE results directly from the sqlite3 handle (see SqliteNative.h). The
+# QSQLITE plugin must use the system SQLite (Qt configured with -system-sqlite).
+asyncsql_sqlite_native {
+	DEFINES += ASYNCSQL_SQLITE_NATIVE
+	LIBS += -lsqlite3
+}
+
+SOURCES += \
+	$$PWD/AsyncQuery.cpp \
+	$$PWD/AsyncQueryResult.cpp \
+	$$PWD/ConnectionManager.cpp \
+	$$PWD/CsvImport.cpp \
+	$$PWD/AsynqQueryModel.cpp \
+	$$PWD/AffinityWorker.cpp \
+	$$PWD/PartitionedScan.cpp \
+	$$PWD/QueryGroup.cpp \
+	$$PWD/ResultBuilder.cpp \
+	$$PWD/ResultExporter.cpp \
+	$$PWD/ResultFile.cpp \
+	$$PWD/ResultMemory.cpp \
+	$$PWD/ResultStore.cpp \
+	$$PWD/RetryPolicy.cpp \
+	$$PWD/SchemaCatalog.cpp \
+	$$PWD/SqliteNative.cpp \
+	$$PWD/SqlStatement.cpp \
+	$$PWD/TaskScheduler.cpp \
+	$$PWD/TaskTrace.cpp
+
+HEADERS += \
+	$$PWD/AsyncQuery.h \
+	$$PWD/AsyncQueryResult.h \
+	$$PWD/ConnectionManager.h \
+	$$PWD/CsvImport.h \
+	$$PWD/AsynqQueryModel.h \
+	$$PWD/AffinityWorker.h \
+	$$PWD/MpscQueue.h \
+	$$PWD/PartitionedScan.h \
+	$$PWD/QueryGroup.h \
+	$$PWD/ResultBuilder.h \
+	$$PWD/ResultExporter.h \
+	$$PWD/ResultFile.h \
+	$$PWD/ResultMemory.h \
+	$$PWD/ResultStore.h \
+	$$PWD/RetryPolicy.h \
+	$$PWD/SchemaCatalog.h \
+	$$PWD/SlowQueryInfo.h \
+	$$PWD/SqliteNative.h \
+	$$PWD/SqlStatement.h \
+	$$PWD/TaskScheduler.h \
+	$$PWD/TaskTrace.h
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QAtomicPointer>
+
+namespace Database {
+
+/**
+ * @brief Unbounded lock-free queue for many producers and a single consumer.
+ *
+ * @details enqueue() may be called from any thread and never blocks, it links the
+ * node with one atomic exchange. dequeue() must only be called by one thread at a
+ * time, the consumer. The role of the consumer may move between threads, if the
+ * hand over is synchronized (e.g. by an atomic counter as AsyncQuery does).
+ *
+ * dequeue() returns \c false if the queue is empty, but also for a short moment
+ * while a producer links a node behind the last one. A consumer which knows a value
+ * was enqueued retries then.
+ */
+template <typename T>
+class MpscQueue
+{
+public:
+	MpscQueue()
+	{
+		Node *stub = new Node;
+		_head.storeRelease(stub);
+		_tail = stub;
+	}
+
+	virtual ~MpscQueue()
+	{
+		T value;
+		while (dequeue(&value)) {
+		}
+		delete _tail;
+	}
+
+	/**
+	 * @brief Appends value, may be called concurrently from any thread.
+	 */
+	void enqueue(const T &value)
+	{
+		Node *node = new Node;
+		node->value = value;
+		Node *prev = _head.fetchAndStoreOrdered(node);
+		prev->next.storeRelease(node);
+	}
+
+	/**
+	 * @brief Removes the oldest value, only called by the consumer.
+	 * @returns \c false if no linked value is available.
+	 */
+	bool dequeue(T *value)
+	{
+		Node *tail = _tail;
+		Node *next = tail->next.loadAcquire();
+		if (next == nullptr) {
+			return false;
+		}
+		//next becomes the stub, its value is not needed anymore
+		*value = next->value;
+		next->value = T();
+		_tail = next;
+		delete tail;
+		return true;
+	}
+
+private:
+	typedef struct Node {
+		Node() : next(nullptr) {}
+		QAtomicPointer<Node> next;
+		T value;
+	} Node;
+
+	Q_DISABLE_COPY(MpscQueue)
+
+	/* last node, written by producers */
+	QAtomicPointer<Node> _head;
+	/* stub before the oldest value, only used by the consumer */
+	Node *_tail;
+};
+
+}	//	namespace
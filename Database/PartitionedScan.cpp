@@ -0,0 +1,197 @@
+#include "PartitionedScan.h"
+#include "AsyncQuery.h"
+#include "ConnectionManager.h"
+#include "ResultBuilder.h"
+
+#include <QRunnable>
+#include <QSqlQuery>
+#include <QThreadPool>
+
+#include <limits>
+
+namespace Database {
+
+namespace {
+
+/* strips trailing semicolons, so the query can be used as sub query */
+QString subQuery(const QString &query)
+{
+	QString ret = query.trimmed();
+	while (ret.endsWith(';')) {
+		ret.chop(1);
+		ret = ret.trimmed();
+	}
+	return ret;
+}
+
+/* helper task, executes partitions on the connection of its pool thread */
+class PartitionTaskPrivate : public QRunnable
+{
+public:
+	explicit PartitionTaskPrivate(const QSharedPointer<PartitionedScan> &scan)
+		: _scan(scan)
+	{
+	}
+
+	void run() override
+	{
+		ConnectionManager* conmgr = ConnectionManager::instance();
+		if (!conmgr->connectionExists()) {
+			conmgr->open();
+		}
+		_scan->work(conmgr->threadConnection());
+	}
+
+private:
+	QSharedPointer<PartitionedScan> _scan;
+};
+
+}
+
+AsyncQueryResult PartitionedScan::exec(const QSqlDatabase &db, const QString &query,
+									   const PartitionSpec &spec, qint64 memoryLimit)
+{
+	const QString sub = subQuery(query);
+	PartitionSpec parts = spec;
+	if (parts.partitions <= 0) {
+		parts.partitions = QThreadPool::globalInstance()->maxThreadCount();
+	}
+
+	if (!parts.hasRange) {
+		QSqlQuery range = QSqlQuery(db);
+		bool succ = range.exec(QString("SELECT MIN(%1), MAX(%1) FROM (%2) AS aq_part")
+							   .arg(parts.column, sub));
+		if (!succ || !range.next() || range.isNull(0)) {
+			//error or nothing to partition, run the query as it is
+			QSqlQuery single = QSqlQuery(db);
+			single.exec(query);
+			ResultBuilder builder(memoryLimit, AsyncQuery::globalMemoryLimit());
+			builder.fetch(single);
+			return builder.result();
+		}
+		parts.min = range.value(0).toLongLong();
+		parts.max = range.value(1).toLongLong();
+	}
+
+	QSharedPointer<PartitionedScan> scan(new PartitionedScan(sub, parts));
+
+	QThreadPool* pool = QThreadPool::globalInstance();
+	for (int ii = 1; ii < scan->_results.size(); ii++) {
+		pool->start(new PartitionTaskPrivate(scan));
+	}
+
+	scan->work(db);
+	scan->waitDone();
+	return scan->merge(memoryLimit);
+}
+
+PartitionedScan::PartitionedScan(const QString &query, const PartitionSpec &spec)
+	: _query(query)
+	, _spec(spec)
+	, _next(0)
+{
+	if (_spec.max < _spec.min) {
+		_spec.max = _spec.min;
+	}
+
+	//split the values of [min, max] into ranges which tile it exactly, the number of
+	//values does not fit into 64 bits for the full range
+	quint64 span = quint64(_spec.max) - quint64(_spec.min);
+	quint64 values = (span == std::numeric_limits<quint64>::max()) ? span : span + 1;
+	int count = qMax(1, _spec.partitions);
+	if (values < quint64(count)) {
+		count = int(values);
+	}
+
+	//ii * values / count without overflow, ii * rem < count * count fits into 64 bits
+	const quint64 quot = values / quint64(count);
+	const quint64 rem = values % quint64(count);
+	for (int ii = 0; ii < count; ii++) {
+		qint64 lo = qint64(quint64(_spec.min) + ii * quot + (ii * rem) / quint64(count));
+		qint64 next = qint64(quint64(_spec.min) + (ii + 1) * quot
+							 + ((ii + 1) * rem) / quint64(count));
+
+		//half-open ranges, REAL values between two integer bounds are covered
+		QStringList terms;
+		if (ii > 0) {
+			terms << QString("%1 >= %2").arg(_spec.column).arg(lo);
+		} else if (_spec.hasRange) {
+			terms << QString("%1 >= %2").arg(_spec.column).arg(_spec.min);
+		}
+		if (ii < count - 1) {
+			terms << QString("%1 < %2").arg(_spec.column).arg(next);
+		} else if (_spec.hasRange) {
+			terms << QString("%1 <= %2").arg(_spec.column).arg(_spec.max);
+		}
+
+		//without a given range the scan covers all rows, NULL values included
+		QString condition = terms.isEmpty() ? QString("1 = 1") : terms.join(" AND ");
+		if (ii == 0 && !_spec.hasRange) {
+			condition = QString("(%1 OR %2 IS NULL)").arg(condition, _spec.column);
+		}
+		_conditions << condition;
+	}
+	_results.resize(count);
+}
+
+PartitionedScan::~PartitionedScan()
+{
+}
+
+void PartitionedScan::work(const QSqlDatabase &db)
+{
+	forever {
+		int idx = _next.fetchAndAddRelaxed(1);
+		if (idx >= _results.size()) {
+			break;
+		}
+
+		QString statement = QString("SELECT * FROM (%1) AS aq_part WHERE %2")
+			.arg(_query, _conditions.at(idx));
+		if (_spec.ordered) {
+			statement += " ORDER BY " + _spec.column;
+		}
+
+		QSqlQuery query = QSqlQuery(db);
+		query.exec(statement);
+		ResultBuilder builder(0, AsyncQuery::globalMemoryLimit());
+		builder.fetch(query);
+		AsyncQueryResult result = builder.result();
+
+		QMutexLocker locker(&_mutex);
+		_results[idx] = result;
+		_completed.append(idx);
+		_condition.wakeAll();
+	}
+}
+
+void PartitionedScan::waitDone()
+{
+	QMutexLocker locker(&_mutex);
+	while (_completed.size() < _results.size()) {
+		_condition.wait(&_mutex);
+	}
+}
+
+AsyncQueryResult PartitionedScan::merge(qint64 memoryLimit)
+{
+	//the first failed partition fails the scan
+	for (int ii = 0; ii < _completed.size(); ii++) {
+		const AsyncQueryResult &res = _results.at(_completed.at(ii));
+		if (!res.isValid()) {
+			ResultBuilder builder;
+			builder.setRecord(res.headRecord());
+			builder.setError(res.error());
+			return builder.result();
+		}
+	}
+
+	ResultBuilder builder(memoryLimit, AsyncQuery::globalMemoryLimit());
+	builder.setRecord(_results.at(0).headRecord());
+	for (int ii = 0; ii < _results.size(); ii++) {
+		builder.appendResult(_results.at(_spec.ordered ? ii : _completed.at(ii)));
+	}
+	return builder.result();
+}
+
+}	//	namespace
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "AsyncQueryResult.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QWaitCondition>
+
+namespace Database {
+
+/**
+ * @brief Describes how a query is split by AsyncQuery::startExecPartitioned().
+ */
+typedef struct PartitionSpec {
+	/** Numeric result column the ranges refer to. */
+	QString column;
+	/** If \c false the range is determined with MIN() and MAX() of the column. */
+	bool hasRange;
+	qint64 min;
+	qint64 max;
+	/** Number of partitions, 0 means number of threads of the global thread pool. */
+	int partitions;
+	/** Merge partitions in range order (ordered by column), otherwise in order of
+	 * completion. */
+	bool ordered;
+} PartitionSpec;
+
+/**
+ * @brief Executes a query as parallel scans over ranges of a column and merges the
+ * partial results.
+ *
+ * @details The calling task computes the ranges and starts helper tasks in the global
+ * thread pool. Every participant, including the calling task, takes the next
+ * unprocessed partition and executes it on the connection of its thread, until no
+ * partition is left. The calling task therefore never waits for partitions which
+ * are not started yet, so the scan can not starve the pool.
+ */
+class PartitionedScan
+{
+public:
+	/**
+	 * @brief Runs the scan on the connection db of the calling thread and returns
+	 * the merged result.
+	 */
+	static AsyncQueryResult exec(const QSqlDatabase &db, const QString &query,
+								 const PartitionSpec &spec, qint64 memoryLimit);
+
+	PartitionedScan(const QString &query, const PartitionSpec &spec);
+	virtual ~PartitionedScan();
+
+	/**
+	 * @brief Executes partitions until none is left.
+	 */
+	void work(const QSqlDatabase &db);
+
+private:
+	void waitDone();
+	AsyncQueryResult merge(qint64 memoryLimit);
+
+private:
+	QString _query;
+	PartitionSpec _spec;
+	/* WHERE condition of each partition */
+	QStringList _conditions;
+	QVector<AsyncQueryResult> _results;
+	QVector<int> _completed;
+	QAtomicInt _next;
+
+	QMutex _mutex;
+	QWaitCondition _condition;
+};
+
+}	//	namespace
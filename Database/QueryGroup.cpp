@@ -0,0 +1,189 @@
+#include "QueryGroup.h"
+#include "AsyncQuery.h"
+#include "ResultBuilder.h"
+
+#include <QSqlError>
+
+namespace Database {
+
+QueryGroup::QueryGroup(QObject *parent)
+	: QObject(parent)
+	, logger("Database.QueryGroup")
+	, _policy(Policy_CollectAll)
+	, _pending(0)
+	, _generation(0)
+	, _running(false)
+{
+	_aQuery = new AsyncQuery(this);
+	connect (_aQuery, SIGNAL(execDone(Database::AsyncQueryResult)),
+			 this, SLOT(onExecDone(Database::AsyncQueryResult)));
+}
+
+QueryGroup::~QueryGroup()
+{
+}
+
+AsyncQuery *QueryGroup::asyncQuery() const
+{
+	return _aQuery;
+}
+
+void QueryGroup::setPolicy(QueryGroup::Policy policy)
+{
+	_policy = policy;
+}
+
+QueryGroup::Policy QueryGroup::policy() const
+{
+	return _policy;
+}
+
+int QueryGroup::addQuery(const QString &query, const QVariant &tag)
+{
+	Entry entry;
+	entry.query = query;
+	entry.isPrepared = false;
+	entry.tag = tag;
+	_entries.append(entry);
+	return _entries.size() - 1;
+}
+
+int QueryGroup::addQuery(const QString &query, const QMap<QString, QVariant> &boundValues,
+						 const QVariant &tag)
+{
+	Entry entry;
+	entry.query = query;
+	entry.isPrepared = true;
+	entry.boundValues = boundValues;
+	entry.tag = tag;
+	_entries.append(entry);
+	return _entries.size() - 1;
+}
+
+void QueryGroup::clear()
+{
+	if (_running) {
+		return;
+	}
+	_entries.clear();
+	_results.clear();
+	_finished.clear();
+}
+
+int QueryGroup::count() const
+{
+	return _entries.size();
+}
+
+bool QueryGroup::start()
+{
+	if (_running || _entries.isEmpty()) {
+		return false;
+	}
+
+	//results of a previous run are discarded by the generation of the tag
+	_generation++;
+	_results = QVector<AsyncQueryResult>(_entries.size());
+	_finished = QVector<bool>(_entries.size(), false);
+	_pending = _entries.size();
+	_running = true;
+
+	for (int ii = 0; ii < _entries.size(); ii++) {
+		const Entry &entry = _entries.at(ii);
+		_aQuery->setTag(QVariantList() << _generation << ii);
+
+		bool succ;
+		if (entry.isPrepared) {
+			_aQuery->prepare(entry.query);
+			_aQuery->clearBoundValues();
+			QMapIterator<QString, QVariant> i(entry.boundValues);
+			while (i.hasNext()) {
+				i.next();
+				_aQuery->bindValue(i.key(), i.value());
+			}
+			succ = _aQuery->startExec();
+		} else {
+			succ = _aQuery->startExec(entry.query);
+		}
+
+		if (!succ) {
+			qCDebug(logger) << "Query" << ii << "rejected, group is not started";
+			_generation++;
+			_running = false;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool QueryGroup::isRunning() const
+{
+	return _running;
+}
+
+bool QueryGroup::isValid() const
+{
+	for (int ii = 0; ii < _results.size(); ii++) {
+		if (!_results.at(ii).isValid()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+QList<AsyncQueryResult> QueryGroup::results() const
+{
+	return _results.toList();
+}
+
+AsyncQueryResult QueryGroup::result(int index) const
+{
+	return _results.value(index);
+}
+
+AsyncQueryResult QueryGroup::resultByTag(const QVariant &tag) const
+{
+	for (int ii = 0; ii < _entries.size() && ii < _results.size(); ii++) {
+		if (_entries.at(ii).tag == tag) {
+			return _results.at(ii);
+		}
+	}
+	return AsyncQueryResult();
+}
+
+void QueryGroup::onExecDone(const Database::AsyncQueryResult &result)
+{
+	//tag is [generation, index]
+	QVariantList tag = result.tag().toList();
+	if (!_running || tag.size() != 2 || tag.at(0).toInt() != _generation) {
+		return;
+	}
+	int idx = tag.at(1).toInt();
+	if (idx < 0 || idx >= _results.size() || _finished.at(idx)) {
+		return;
+	}
+
+	_results[idx] = result;
+	_finished[idx] = true;
+	_pending--;
+
+	if (_pending == 0 || (_policy == Policy_FailFast && !result.isValid())) {
+		finish();
+	}
+}
+
+void QueryGroup::finish()
+{
+	for (int ii = 0; ii < _results.size(); ii++) {
+		if (!_finished.at(ii)) {
+			ResultBuilder builder;
+			builder.setError(QSqlError(QString(), QString("Canceled, a query of the group failed"),
+									   QSqlError::UnknownError));
+			_results[ii] = builder.result();
+		}
+	}
+	_running = false;
+	emit allDone(results());
+}
+
+}	//	namespace
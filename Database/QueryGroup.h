@@ -0,0 +1,142 @@
+#pragma once
+
+#include "AsyncQueryResult.h"
+
+#include <QList>
+#include <QLoggingCategory>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+
+namespace Database {
+
+// class forward decl's
+class AsyncQuery;
+
+/**
+ * @brief Runs a group of queries in parallel and delivers all results at once.
+ *
+ * @details The queries are added with addQuery() and started together with start().
+ * They run in parallel in the global thread pool, allDone() is emitted once with the
+ * results in the order the queries were added. Results can also be looked up by the
+ * tag given to addQuery().
+ *
+ * Sample Usage:
+ * \code{.cpp}
+ * Database::QueryGroup *group = new Database::QueryGroup(this);
+ * group->addQuery("SELECT COUNT(*) FROM Customers", "customers");
+ * group->addQuery("SELECT COUNT(*) FROM Orders", "orders");
+ * connect (group, SIGNAL(allDone(QList<Database::AsyncQueryResult>)), ...);
+ * group->start();
+ * \endcode
+ */
+class QueryGroup : public QObject
+{
+	Q_OBJECT
+
+public:
+	/**
+	 * @brief Defines when a group with failing queries is done.
+	 */
+	typedef enum Policy {
+		/** allDone() is emitted when all queries are finished. */
+		Policy_CollectAll,
+		/** allDone() is emitted at the first failed query. The results of queries
+		 * which are not finished yet are invalid, they are discarded on arrival. */
+		Policy_FailFast
+	} Policy;
+
+	explicit QueryGroup(QObject *parent = nullptr);
+	virtual ~QueryGroup();
+
+	/**
+	 * @brief The AsyncQuery executing the queries, e.g. to set a memory limit or a
+	 * retry policy. Its mode and delivery must not be changed.
+	 */
+	AsyncQuery *asyncQuery() const;
+
+	void setPolicy(Policy policy);
+	Policy policy() const;
+
+	/**
+	 * @brief Adds a query to the group.
+	 * @returns The index of the query in the results.
+	 */
+	int addQuery(const QString &query, const QVariant &tag = QVariant());
+
+	/**
+	 * @brief Adds a prepared query with bound values to the group.
+	 */
+	int addQuery(const QString &query, const QMap<QString, QVariant> &boundValues,
+				 const QVariant &tag = QVariant());
+
+	/**
+	 * @brief Removes all queries and results. Has no effect while running.
+	 */
+	void clear();
+
+	/**
+	 * @brief Number of added queries.
+	 */
+	int count() const;
+
+	/**
+	 * @brief Starts all queries, results of a previous run are discarded.
+	 * @returns \c false if the group is running or empty, or a query was rejected
+	 * by the admission control.
+	 */
+	bool start();
+
+	bool isRunning() const;
+
+	/**
+	 * @brief Returns \c true if all queries of the last run succeeded.
+	 */
+	bool isValid() const;
+
+	/**
+	 * @brief Results of the last run in the order the queries were added.
+	 */
+	QList<AsyncQueryResult> results() const;
+	AsyncQueryResult result(int index) const;
+
+	/**
+	 * @brief Result of the first query with given tag.
+	 */
+	AsyncQueryResult resultByTag(const QVariant &tag) const;
+
+signals:
+	/**
+	 * @brief Is emitted once per run when the group is done, see Policy.
+	 */
+	void allDone(const QList<Database::AsyncQueryResult> &results);
+
+private slots:
+	void onExecDone(const Database::AsyncQueryResult &result);
+
+private:
+	/* marks unfinished queries as canceled and emits allDone() */
+	void finish();
+
+private:
+	typedef struct Entry {
+		QString query;
+		bool isPrepared;
+		QMap<QString, QVariant> boundValues;
+		QVariant tag;
+	} Entry;
+
+	QLoggingCategory logger;
+	AsyncQuery *_aQuery;
+	Policy _policy;
+	QList<Entry> _entries;
+	QVector<AsyncQueryResult> _results;
+	QVector<bool> _finished;
+	int _pending;
+	int _generation;
+	bool _running;
+};
+
+}	//	namespace
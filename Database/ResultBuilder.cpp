@@ -0,0 +1,230 @@
+#include "ResultBuilder.h"
+#include "ResultMemory.h"
+#include "ResultStore.h"
+
+#include <QSqlQuery>
+#include <QSqlRecord>
+
+namespace Database {
+
+namespace {
+
+/* a column is no longer interned if it has more distinct values than this and more
+ * than every second value is distinct */
+const int kMaxDistinct = 1024;
+
+}
+
+QAtomicInteger<qint64> ResultBuilder::_globalBytes(0);
+
+ResultBuilder::ResultBuilder(qint64 memoryLimit, qint64 globalLimit)
+	: logger("Database.ResultBuilder")
+	, _memoryLimit(memoryLimit)
+	, _globalLimit(globalLimit)
+	, _bytes(0)
+	, _resultBytes(0)
+	, _storeFailed(false)
+	, _intern(false)
+	, _internedValues(0)
+	, _sharedValues(0)
+{
+}
+
+ResultBuilder::~ResultBuilder()
+{
+	release();
+}
+
+void ResultBuilder::setRecord(const QSqlRecord &record)
+{
+	_result.setRecord(record);
+
+	if (_intern) {
+		int cols = record.count();
+		_dicts = QVector<QSet<QString>>(cols);
+		_interned = QVector<bool>(cols, true);
+		_values = QVector<qint64>(cols, 0);
+	}
+}
+
+void ResultBuilder::setError(const QSqlError &error)
+{
+	_result._error = error;
+}
+
+void ResultBuilder::setInternStrings(bool intern)
+{
+	_intern = intern;
+}
+
+void ResultBuilder::appendRow(const QVector<QVariant> &row)
+{
+	appendRow(row, 0);
+}
+
+void ResultBuilder::appendRow(const QVector<QVariant> &row, qint64 sharedBytes)
+{
+	if (_store) {
+		if (!_storeFailed && !_store->appendRow(row)) {
+			qCCritical(logger) << "ResultBuilder::appendRow: write to spill file failed";
+			_storeFailed = true;
+		}
+		return;
+	}
+
+	_result._data.append(row);
+	qint64 sz = ResultStore::estimateSize(row) - sharedBytes;
+	_resultBytes += sz;
+
+	if (_memoryLimit > 0 || _globalLimit > 0) {
+		_bytes += sz;
+		qint64 global = _globalBytes.fetchAndAddRelaxed(sz) + sz;
+
+		if ((_memoryLimit > 0 && _bytes > _memoryLimit)
+				|| (_globalLimit > 0 && global > _globalLimit)) {
+			spill();
+		}
+	}
+}
+
+void ResultBuilder::fetch(QSqlQuery &query)
+{
+	setRecord(query.record());
+	setError(query.lastError());
+	int cols = _result._record.count();
+
+	while (query.next()) {
+		QVector<QVariant> currow(cols);
+
+		for (int ii = 0; ii < cols; ii++) {
+			if (query.isNull(ii)) {
+				currow[ii] = QVariant();
+			}
+			else {
+				currow[ii] = query.value(ii);
+			}
+		}
+		appendFetchedRow(currow);
+	}
+}
+
+void ResultBuilder::appendFetchedRow(QVector<QVariant> &row)
+{
+	//spilled rows are serialized, sharing does not matter there
+	qint64 shared = 0;
+	if (_intern && !_store) {
+		for (int ii = 0; ii < row.size() && ii < _interned.size(); ii++) {
+			if (_interned.at(ii) && row.at(ii).userType() == QMetaType::QString) {
+				row[ii] = intern(ii, row.at(ii).toString(), &shared);
+			}
+		}
+	}
+	appendRow(row, shared);
+}
+
+QString ResultBuilder::intern(int col, const QString &str, qint64 *sharedBytes)
+{
+	_values[col]++;
+	_internedValues++;
+
+	QSet<QString> &dict = _dicts[col];
+	QSet<QString>::const_iterator it = dict.constFind(str);
+	if (it != dict.constEnd()) {
+		_sharedValues++;
+		*sharedBytes += 32 + str.size() * 2;
+		return *it;
+	}
+
+	if (dict.size() >= kMaxDistinct && dict.size() * 2 > _values.at(col)) {
+		//high cardinality, rows interned so far keep their shared strings
+		_interned[col] = false;
+		dict.clear();
+		return str;
+	}
+	dict.insert(str);
+	return str;
+}
+
+void ResultBuilder::appendResult(const AsyncQueryResult &other)
+{
+	if (!_store && !other._store && _memoryLimit == 0 && _globalLimit == 0) {
+		//rows are implicitly shared
+		_result._data += other._data;
+		_resultBytes += other.memoryUsage();
+		return;
+	}
+	for (int row = 0; row < other.count(); row++) {
+		appendRow(other._store ? other._store->row(row) : other._data.at(row));
+	}
+}
+
+AsyncQueryResult ResultBuilder::result()
+{
+	if (_internedValues > 0) {
+		_result._dedupRatio = double(_sharedValues) / _internedValues;
+		qCDebug(logger) << "ResultBuilder::result: interned" << _internedValues
+			<< "strings, dedup ratio" << _result._dedupRatio;
+	}
+	_dicts.clear();
+
+	if (_store) {
+		if (_storeFailed || !_store->finish()) {
+			//the rows are lost, a store that is not mapped must not be handed out
+			qCCritical(logger) << "ResultBuilder::result: writing or mapping spill file failed";
+			_result._error = QSqlError(QString(), QString("Writing the spill file failed"),
+									   QSqlError::UnknownError);
+		} else {
+			_result._store = _store;
+		}
+		_store.clear();
+	} else if (_resultBytes > 0) {
+		//counted by ResultMemory while any copy of the result is alive
+		_result._memory = QSharedPointer<const ResultMemoryToken>(
+			new ResultMemoryToken(_resultBytes));
+	}
+	return _result;
+}
+
+qint64 ResultBuilder::globalBytes()
+{
+	return _globalBytes.load();
+}
+
+void ResultBuilder::spill()
+{
+	QSharedPointer<ResultStore> store(new ResultStore(_result._record.count()));
+	if (!store->open()) {
+		qCWarning(logger) << "ResultBuilder::spill: can not create spill file, "
+			"result is kept in memory";
+		_memoryLimit = 0;
+		_globalLimit = 0;
+		return;
+	}
+
+	qCDebug(logger) << "ResultBuilder::spill:" << _result._data.size()
+		<< "rows," << _bytes << "bytes";
+
+	for (int ii = 0; ii < _result._data.size(); ii++) {
+		if (!store->appendRow(_result._data.at(ii))) {
+			qCWarning(logger) << "ResultBuilder::spill: write to spill file failed, "
+				"result is kept in memory";
+			_memoryLimit = 0;
+			_globalLimit = 0;
+			return;
+		}
+	}
+	_result._data.clear();
+	_resultBytes = 0;
+	_store = store;
+	release();
+}
+
+void ResultBuilder::release()
+{
+	if (_bytes > 0) {
+		_globalBytes.fetchAndAddRelaxed(-_bytes);
+		_bytes = 0;
+	}
+}
+
+}	//	namespace
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "AsyncQueryResult.h"
+
+#include <QAtomicInteger>
+#include <QLoggingCategory>
+#include <QSet>
+#include <QSharedPointer>
+#include <QVector>
+
+class QSqlQuery;
+
+namespace Database {
+
+// class forward decl's
+class ResultStore;
+
+/**
+ * @brief Collects the rows of a query into a AsyncQueryResult.
+ *
+ * @details Rows are kept in memory until the memory limit of the query or the global
+ * limit of all running queries is exceeded. Then all rows are spilled into a
+ * ResultStore and the result reads them lazily from the memory mapped file.
+ *
+ * @note A ResultBuilder is used by one thread only.
+ */
+class ResultBuilder
+{
+public:
+	/**
+	 * @param memoryLimit Maximum number of bytes kept in memory, 0 means no limit.
+	 * @param globalLimit Maximum number of bytes kept in memory by all builders, 0
+	 * means no limit.
+	 */
+	ResultBuilder(qint64 memoryLimit = 0, qint64 globalLimit = 0);
+	virtual ~ResultBuilder();
+
+	void setRecord(const QSqlRecord &record);
+	void setError(const QSqlError &error);
+
+	/**
+	 * @brief Interns the strings of text columns of fetched rows, equal values of a
+	 * column share one QString. A column with many distinct values is no longer
+	 * interned. Call it before setRecord().
+	 */
+	void setInternStrings(bool intern);
+
+	/**
+	 * @brief Appends a row to the result.
+	 */
+	void appendRow(const QVector<QVariant> &row);
+
+	/**
+	 * @brief Appends a row fetched from the database, strings are interned if
+	 * enabled.
+	 */
+	void appendFetchedRow(QVector<QVariant> &row);
+
+	/**
+	 * @brief Sets record and error of an executed query and appends all its rows.
+	 */
+	void fetch(QSqlQuery &query);
+
+	/**
+	 * @brief Appends all rows of another result with the same columns.
+	 */
+	void appendResult(const AsyncQueryResult &other);
+
+	/**
+	 * @brief Finishes the result. The builder must not be used afterwards.
+	 */
+	AsyncQueryResult result();
+
+	/**
+	 * @brief Number of bytes currently kept in memory by all builders.
+	 */
+	static qint64 globalBytes();
+
+private:
+	/* sharedBytes are the bytes of interned values, which are not counted */
+	void appendRow(const QVector<QVariant> &row, qint64 sharedBytes);
+	/* returns the interned string, sharedBytes is increased if it was known */
+	QString intern(int col, const QString &str, qint64 *sharedBytes);
+	void spill();
+	void release();
+
+private:
+	QLoggingCategory logger;
+	AsyncQueryResult _result;
+	QSharedPointer<ResultStore> _store;
+	qint64 _memoryLimit;
+	qint64 _globalLimit;
+	qint64 _bytes;
+	/* estimated size of the rows in memory, see ResultMemory */
+	qint64 _resultBytes;
+	/* a write to _store failed, the spilled rows are incomplete */
+	bool _storeFailed;
+
+	//string interning
+	bool _intern;
+	QVector<QSet<QString>> _dicts;
+	QVector<bool> _interned;
+	QVector<qint64> _values;
+	qint64 _internedValues;
+	qint64 _sharedValues;
+
+	static QAtomicInteger<qint64> _globalBytes;
+};
+
+}	//	namespace
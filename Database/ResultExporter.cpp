@@ -0,0 +1,266 @@
+#include "ResultExporter.h"
+#include "ResultFile.h"
+
+#include <QDate>
+#include <QDateTime>
+#include <QSqlField>
+#include <QTime>
+
+#include <cmath>
+
+namespace Database {
+
+namespace {
+
+/* rows are written to the file in chunks of this size */
+const int FlushSize = 1024 * 1024;
+
+QByteArray textValue(const QVariant &val)
+{
+	switch (val.type()) {
+	case QVariant::Date:
+		return val.toDate().toString(Qt::ISODate).toUtf8();
+	case QVariant::Time:
+		return val.toTime().toString(Qt::ISODate).toUtf8();
+	case QVariant::DateTime:
+		return val.toDateTime().toString(Qt::ISODate).toUtf8();
+	case QVariant::ByteArray:
+		return val.toByteArray().toBase64();
+	default:
+		return val.toString().toUtf8();
+	}
+}
+
+void appendJsonString(QByteArray *out, const QByteArray &utf8)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	out->append('"');
+	for (int ii = 0; ii < utf8.size(); ii++) {
+		const uchar ch = uchar(utf8.at(ii));
+		switch (ch) {
+		case '"':  out->append("\\\""); break;
+		case '\\': out->append("\\\\"); break;
+		case '\b': out->append("\\b"); break;
+		case '\f': out->append("\\f"); break;
+		case '\n': out->append("\\n"); break;
+		case '\r': out->append("\\r"); break;
+		case '\t': out->append("\\t"); break;
+		default:
+			if (ch < 0x20) {
+				out->append("\\u00");
+				out->append(hex[ch >> 4]);
+				out->append(hex[ch & 0x0f]);
+			}
+			else {
+				out->append(char(ch));
+			}
+		}
+	}
+	out->append('"');
+}
+
+}
+
+ResultExporter::ResultExporter(const QString &fileName, AsyncQuery::ExportFormat format)
+	: _file(fileName)
+	, _format(format)
+	, _rows(0)
+	, _bytes(0)
+{
+	_buffer.reserve(FlushSize);
+}
+
+ResultExporter::~ResultExporter()
+{
+	if (_file.isOpen()) {
+		_file.cancelWriting();
+	}
+}
+
+bool ResultExporter::open(const QSqlRecord &record)
+{
+	if (!_file.open(QIODevice::WriteOnly)) {
+		_errorString = _file.errorString();
+		return false;
+	}
+
+	switch (_format) {
+	case AsyncQuery::Export_Csv:
+		for (int ii = 0; ii < record.count(); ii++) {
+			if (ii > 0) {
+				_buffer.append(',');
+			}
+			appendCsv(record.fieldName(ii));
+		}
+		_buffer.append("\r\n");
+		break;
+	case AsyncQuery::Export_JsonLines:
+		for (int ii = 0; ii < record.count(); ii++) {
+			QByteArray key;
+			appendJsonString(&key, record.fieldName(ii).toUtf8());
+			key.append(':');
+			_keys.append(key);
+		}
+		break;
+	case AsyncQuery::Export_Binary:
+		_binary.reset(new ResultFileWriter(&_file));
+		if (!_binary->writeHeader(record)) {
+			_errorString = _file.errorString();
+			return false;
+		}
+		break;
+	}
+	return true;
+}
+
+bool ResultExporter::writeRow(const QVector<QVariant> &row)
+{
+	_rows++;
+
+	switch (_format) {
+	case AsyncQuery::Export_Csv:
+		for (int ii = 0; ii < row.size(); ii++) {
+			if (ii > 0) {
+				_buffer.append(',');
+			}
+			appendCsv(row.at(ii));
+		}
+		_buffer.append("\r\n");
+		break;
+	case AsyncQuery::Export_JsonLines:
+		_buffer.append('{');
+		for (int ii = 0; ii < row.size() && ii < _keys.size(); ii++) {
+			if (ii > 0) {
+				_buffer.append(',');
+			}
+			_buffer.append(_keys.at(ii));
+			appendJson(row.at(ii));
+		}
+		_buffer.append("}\n");
+		break;
+	case AsyncQuery::Export_Binary:
+		if (!_binary->writeRow(row)) {
+			_errorString = _file.errorString();
+			return false;
+		}
+		return true;
+	}
+
+	if (_buffer.size() >= FlushSize) {
+		return flush();
+	}
+	return true;
+}
+
+bool ResultExporter::finish()
+{
+	bool succ = _binary ? _binary->finish() : flush();
+	if (!succ) {
+		_errorString = _file.errorString();
+		_file.cancelWriting();
+		return false;
+	}
+	if (!_file.commit()) {
+		_errorString = _file.errorString();
+		return false;
+	}
+	return true;
+}
+
+void ResultExporter::cancel()
+{
+	if (_file.isOpen()) {
+		_file.cancelWriting();
+	}
+}
+
+qint64 ResultExporter::rowCount() const
+{
+	return _rows;
+}
+
+qint64 ResultExporter::bytesWritten() const
+{
+	return _binary ? _binary->bytesWritten() : _bytes + _buffer.size();
+}
+
+QString ResultExporter::errorString() const
+{
+	return _errorString;
+}
+
+QSqlRecord ResultExporter::summaryRecord()
+{
+	QSqlRecord record;
+	record.append(QSqlField("FileName", QVariant::String));
+	record.append(QSqlField("Rows", QVariant::LongLong));
+	record.append(QSqlField("Bytes", QVariant::LongLong));
+	return record;
+}
+
+void ResultExporter::appendCsv(const QVariant &val)
+{
+	if (val.isNull()) {
+		return;
+	}
+	QByteArray text = textValue(val);
+	bool quote = false;
+	for (int ii = 0; ii < text.size() && !quote; ii++) {
+		const char ch = text.at(ii);
+		quote = (ch == ',' || ch == '"' || ch == '\n' || ch == '\r');
+	}
+	if (!quote) {
+		_buffer.append(text);
+		return;
+	}
+	_buffer.append('"');
+	_buffer.append(text.replace('"', "\"\""));
+	_buffer.append('"');
+}
+
+void ResultExporter::appendJson(const QVariant &val)
+{
+	if (val.isNull()) {
+		_buffer.append("null");
+		return;
+	}
+
+	switch (val.type()) {
+	case QVariant::Bool:
+		_buffer.append(val.toBool() ? "true" : "false");
+		break;
+	case QVariant::Int:
+	case QVariant::LongLong:
+		_buffer.append(QByteArray::number(val.toLongLong()));
+		break;
+	case QVariant::UInt:
+	case QVariant::ULongLong:
+		_buffer.append(QByteArray::number(val.toULongLong()));
+		break;
+	case QVariant::Double: {
+		double d = val.toDouble();
+		_buffer.append(std::isfinite(d) ? QByteArray::number(d, 'g', 17) : "null");
+		break;
+	}
+	default:
+		appendJsonString(&_buffer, textValue(val));
+		break;
+	}
+}
+
+bool ResultExporter::flush()
+{
+	if (_buffer.isEmpty()) {
+		return true;
+	}
+	if (_file.write(_buffer) != _buffer.size()) {
+		_errorString = _file.errorString();
+		return false;
+	}
+	_bytes += _buffer.size();
+	_buffer.resize(0);
+	return true;
+}
+
+}	//	namespace
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "AsyncQuery.h"
+
+#include <QByteArray>
+#include <QList>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QSqlRecord>
+#include <QVector>
+
+namespace Database {
+
+// class forward decl's
+class ResultFileWriter;
+
+/**
+ * @brief Writes rows to a CSV, JSON lines or binary result file.
+ *
+ * @details Used by AsyncQuery::startExport() to stream the rows of a query cursor
+ * into a file on the worker thread, so only one row is held in memory. Output is
+ * buffered and the file is replaced atomically by finish().
+ *
+ * - CSV: RFC 4180, UTF-8, a header line with the column names, CRLF line endings.
+ * - JSON lines: one UTF-8 JSON object per row and line, keys are the column names.
+ * - Binary: the ResultFile format, which can be read with AsyncQueryResult::load().
+ *
+ * Dates and times are written in ISO 8601 format, byte arrays base64 encoded.
+ */
+class ResultExporter
+{
+public:
+	ResultExporter(const QString &fileName, AsyncQuery::ExportFormat format);
+	virtual ~ResultExporter();
+
+	/**
+	 * @brief Opens the file and writes the header.
+	 */
+	bool open(const QSqlRecord &record);
+	bool writeRow(const QVector<QVariant> &row);
+
+	/**
+	 * @brief Flushes the buffer and replaces the target file.
+	 */
+	bool finish();
+
+	/**
+	 * @brief Discards the written data, the target file is not touched.
+	 */
+	void cancel();
+
+	qint64 rowCount() const;
+	qint64 bytesWritten() const;
+	QString errorString() const;
+
+	/**
+	 * @brief Columns of the summary result of an export: FileName, Rows, Bytes.
+	 */
+	static QSqlRecord summaryRecord();
+
+private:
+	void appendCsv(const QVariant &val);
+	void appendJson(const QVariant &val);
+	bool flush();
+
+private:
+	QSaveFile _file;
+	AsyncQuery::ExportFormat _format;
+	QScopedPointer<ResultFileWriter> _binary;
+	QByteArray _buffer;
+	QList<QByteArray> _keys;
+	qint64 _rows;
+	qint64 _bytes;
+	QString _errorString;
+};
+
+}	//	namespace
@@ -0,0 +1,277 @@
+#include "ResultFile.h"
+#include "ResultStore.h"
+
+#include <QSqlField>
+#include <QtEndian>
+
+#include <climits>
+
+namespace Database {
+
+namespace {
+
+/* rows are written to the device in chunks of this size */
+const int FlushSize = 1024 * 1024;
+
+template <typename T>
+void appendLE(QByteArray *out, T val)
+{
+	uchar buf[sizeof(T)];
+	qToLittleEndian<T>(val, buf);
+	out->append(reinterpret_cast<const char*>(buf), sizeof(T));
+}
+
+void appendString(QByteArray *out, const QString &str)
+{
+	QByteArray utf8 = str.toUtf8();
+	appendLE<quint32>(out, utf8.size());
+	out->append(utf8);
+}
+
+/* bounds checked reading of the header */
+class HeaderParser
+{
+public:
+	HeaderParser(const uchar *data, qint64 size) : _data(data), _size(size), _pos(0) {}
+
+	template <typename T>
+	bool read(T *val)
+	{
+		if (_pos + qint64(sizeof(T)) > _size) {
+			return false;
+		}
+		*val = qFromLittleEndian<T>(_data + _pos);
+		_pos += sizeof(T);
+		return true;
+	}
+
+	bool readString(QString *str)
+	{
+		quint32 len;
+		if (!read(&len) || _pos + len > _size) {
+			return false;
+		}
+		*str = QString::fromUtf8(reinterpret_cast<const char*>(_data + _pos), len);
+		_pos += len;
+		return true;
+	}
+
+	qint64 pos() const { return _pos; }
+
+private:
+	const uchar *_data;
+	qint64 _size;
+	qint64 _pos;
+};
+
+}
+
+/****************************************************************************************/
+/*                                   ResultFileWriter                                   */
+/****************************************************************************************/
+
+ResultFileWriter::ResultFileWriter(QIODevice *device)
+	: _device(device)
+	, _pos(0)
+{
+	_buffer.reserve(FlushSize);
+}
+
+ResultFileWriter::~ResultFileWriter()
+{
+}
+
+bool ResultFileWriter::writeHeader(const QSqlRecord &record, const QSqlError &error)
+{
+	appendLE<quint32>(&_buffer, ResultFile::Magic);
+	appendLE<quint16>(&_buffer, ResultFile::Version);
+	appendLE<quint16>(&_buffer, 0);
+
+	appendLE<qint32>(&_buffer, error.type());
+	appendString(&_buffer, error.driverText());
+	appendString(&_buffer, error.databaseText());
+	appendString(&_buffer, error.nativeErrorCode());
+
+	appendLE<quint32>(&_buffer, record.count());
+	for (int ii = 0; ii < record.count(); ii++) {
+		appendString(&_buffer, record.fieldName(ii));
+		appendLE<qint32>(&_buffer, record.field(ii).type());
+	}
+	return flush();
+}
+
+bool ResultFileWriter::writeRow(const QVector<QVariant> &row)
+{
+	_offsets.append(_pos + _buffer.size());
+	ResultStore::encodeRow(row, &_buffer);
+	if (_buffer.size() >= FlushSize) {
+		return flush();
+	}
+	return true;
+}
+
+bool ResultFileWriter::finish()
+{
+	qint64 indexOffset = _pos + _buffer.size();
+	for (int ii = 0; ii < _offsets.size(); ii++) {
+		appendLE<quint64>(&_buffer, _offsets.at(ii));
+		if (_buffer.size() >= FlushSize && !flush()) {
+			return false;
+		}
+	}
+	appendLE<quint64>(&_buffer, indexOffset);
+	appendLE<quint64>(&_buffer, _offsets.size());
+	appendLE<quint32>(&_buffer, ResultFile::Magic);
+	return flush();
+}
+
+qint64 ResultFileWriter::rowCount() const
+{
+	return _offsets.size();
+}
+
+qint64 ResultFileWriter::bytesWritten() const
+{
+	return _pos + _buffer.size();
+}
+
+bool ResultFileWriter::flush()
+{
+	if (_buffer.isEmpty()) {
+		return true;
+	}
+	qint64 written = _device->write(_buffer);
+	if (written != _buffer.size()) {
+		return false;
+	}
+	_pos += written;
+	_buffer.resize(0);
+	return true;
+}
+
+/****************************************************************************************/
+/*                                   ResultFileReader                                   */
+/****************************************************************************************/
+
+ResultFileReader::ResultFileReader()
+{
+}
+
+ResultFileReader::~ResultFileReader()
+{
+}
+
+bool ResultFileReader::openFile(const QString &fileName)
+{
+	_store = QSharedPointer<ResultStore>(new ResultStore());
+	if (!_store->mapFile(fileName)) {
+		_errorString = "can not map file " + fileName;
+		return false;
+	}
+	return parse();
+}
+
+bool ResultFileReader::openData(const QByteArray &data)
+{
+	_store = QSharedPointer<ResultStore>(new ResultStore());
+	_store->setData(data);
+	return parse();
+}
+
+QSqlRecord ResultFileReader::record() const
+{
+	return _record;
+}
+
+QSqlError ResultFileReader::error() const
+{
+	return _error;
+}
+
+QSharedPointer<ResultStore> ResultFileReader::store() const
+{
+	return _store;
+}
+
+QString ResultFileReader::errorString() const
+{
+	return _errorString;
+}
+
+bool ResultFileReader::parse()
+{
+	const uchar *data = _store->data();
+	const qint64 size = _store->size();
+
+	if (data == nullptr || size < ResultFile::TrailerSize) {
+		_errorString = "file too short";
+		return false;
+	}
+
+	//header
+	HeaderParser header(data, size);
+	quint32 magic;
+	quint16 version, reserved;
+	if (!header.read(&magic) || magic != ResultFile::Magic) {
+		_errorString = "invalid magic";
+		return false;
+	}
+	if (!header.read(&version) || version > ResultFile::Version || !header.read(&reserved)) {
+		_errorString = "unsupported version";
+		return false;
+	}
+
+	qint32 errType;
+	QString driverText, databaseText, nativeCode;
+	quint32 columns;
+	if (!header.read(&errType) || !header.readString(&driverText)
+			|| !header.readString(&databaseText) || !header.readString(&nativeCode)
+			|| !header.read(&columns)) {
+		_errorString = "corrupt header";
+		return false;
+	}
+	_error = QSqlError(driverText, databaseText, QSqlError::ErrorType(errType), nativeCode);
+
+	_record = QSqlRecord();
+	for (quint32 ii = 0; ii < columns; ii++) {
+		QString name;
+		qint32 type;
+		if (!header.readString(&name) || !header.read(&type)) {
+			_errorString = "corrupt header";
+			return false;
+		}
+		_record.append(QSqlField(name, QVariant::Type(type)));
+	}
+
+	//trailer and index, checked without overflow: rows is bounded by the space left
+	const uchar *trailer = data + size - ResultFile::TrailerSize;
+	const quint64 indexEnd = quint64(size - ResultFile::TrailerSize);
+	const quint64 indexOffset = qFromLittleEndian<quint64>(trailer);
+	const quint64 rows = qFromLittleEndian<quint64>(trailer + 8);
+	if (qFromLittleEndian<quint32>(trailer + 16) != ResultFile::Magic
+			|| indexOffset < quint64(header.pos()) || indexOffset > indexEnd
+			|| rows > (indexEnd - indexOffset) / 8 || rows > quint64(INT_MAX)
+			|| indexOffset + rows * 8 != indexEnd) {
+		_errorString = "corrupt index";
+		return false;
+	}
+
+	QVector<qint64> offsets(static_cast<int>(rows));
+	const uchar *index = data + indexOffset;
+	for (int ii = 0; ii < offsets.size(); ii++) {
+		quint64 offset = qFromLittleEndian<quint64>(index + ii * 8);
+		quint64 prev = (ii > 0) ? quint64(offsets.at(ii - 1)) : quint64(header.pos());
+		if (offset < prev || offset > indexOffset) {
+			_errorString = "corrupt index";
+			return false;
+		}
+		offsets[ii] = offset;
+	}
+
+	//the cells of each row are checked when the row is first decoded
+	_store->setRows(columns, offsets, qint64(indexOffset));
+
+	return true;
+}
+
+}	//	namespace
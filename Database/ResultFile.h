@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QSharedPointer>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QVector>
+
+namespace Database {
+
+// class forward decl's
+class ResultStore;
+
+/**
+ * @brief Versioned binary file format of a AsyncQueryResult.
+ *
+ * @details The format is designed to be memory mapped and read without parsing
+ * every cell. All numbers are little endian.
+ *
+ * | part     | content                                                            |
+ * |----------|--------------------------------------------------------------------|
+ * | header   | magic, version, sql error, column count, column names and types    |
+ * | rows     | rows encoded as described in ResultStore (null bitmap, cell types, |
+ * |          | value offsets, values)                                             |
+ * | index    | quint64 file offset of each row                                    |
+ * | trailer  | quint64 index offset, quint64 row count, magic                     |
+ *
+ * Because the index is written after the rows, files can be written in a streaming
+ * fashion with ResultFileWriter without knowing the number of rows in advance.
+ */
+class ResultFile
+{
+public:
+	static const quint32 Magic = 0x46525141;	// "AQRF"
+	static const quint16 Version = 1;
+	static const int TrailerSize = 8 + 8 + 4;
+};
+
+/**
+ * @brief Writes a result file row by row to a QIODevice.
+ * @details Call writeHeader() once, then writeRow() for each row and finish() at last.
+ * The device has to be opened for writing.
+ */
+class ResultFileWriter
+{
+public:
+	explicit ResultFileWriter(QIODevice *device);
+	virtual ~ResultFileWriter();
+
+	bool writeHeader(const QSqlRecord &record, const QSqlError &error = QSqlError());
+	bool writeRow(const QVector<QVariant> &row);
+	bool finish();
+
+	/**
+	 * @brief Number of rows written so far.
+	 */
+	qint64 rowCount() const;
+
+	/**
+	 * @brief Number of bytes written so far.
+	 */
+	qint64 bytesWritten() const;
+
+private:
+	bool flush();
+
+private:
+	QIODevice *_device;
+	QByteArray _buffer;
+	QVector<qint64> _offsets;
+	qint64 _pos;
+};
+
+/**
+ * @brief Reads a result file from a memory mapped file or from a buffer.
+ * @details Only the header and the row index are parsed, values are decoded on
+ * access through the returned ResultStore.
+ */
+class ResultFileReader
+{
+public:
+	ResultFileReader();
+	virtual ~ResultFileReader();
+
+	/**
+	 * @brief Maps the file and reads header and index.
+	 */
+	bool openFile(const QString &fileName);
+
+	/**
+	 * @brief Reads header and index from a buffer.
+	 */
+	bool openData(const QByteArray &data);
+
+	QSqlRecord record() const;
+	QSqlError error() const;
+	QSharedPointer<ResultStore> store() const;
+
+	/**
+	 * @brief Description of the last error of openFile() or openData().
+	 */
+	QString errorString() const;
+
+private:
+	bool parse();
+
+private:
+	QSharedPointer<ResultStore> _store;
+	QSqlRecord _record;
+	QSqlError _error;
+	QString _errorString;
+};
+
+}	//	namespace
@@ -0,0 +1,110 @@
+#include "ResultMemory.h"
+
+#include <climits>
+
+namespace Database {
+
+QAtomicInteger<qint64> ResultMemory::_liveBytes(0);
+QAtomicInt ResultMemory::_liveResults(0);
+QAtomicInteger<qint64> ResultMemory::_budget(0);
+QMutex ResultMemory::_waitMutex;
+QMap<int, std::function<void()>> ResultMemory::_waiters;
+int ResultMemory::_lastWaiter = 0;
+QAtomicInt ResultMemory::_waiterCnt(0);
+
+qint64 ResultMemory::liveBytes()
+{
+	return _liveBytes.load();
+}
+
+int ResultMemory::liveResults()
+{
+	return _liveResults.load();
+}
+
+void ResultMemory::setBudget(qint64 bytes)
+{
+	_budget.store(bytes);
+	wakeWaiters();
+}
+
+qint64 ResultMemory::budget()
+{
+	return _budget.load();
+}
+
+bool ResultMemory::isOverBudget()
+{
+	qint64 budget = _budget.load();
+	return budget > 0 && _liveBytes.load() > budget;
+}
+
+int ResultMemory::waitForBudget(const std::function<void()> &fn)
+{
+	QMutexLocker locker(&_waitMutex);
+	//counted before the bytes are checked, a result released meanwhile sees the waiter
+	_waiterCnt.fetchAndAddOrdered(1);
+	qint64 budget = _budget.load();
+	if (budget <= 0 || _liveBytes.fetchAndAddOrdered(0) <= budget) {
+		_waiterCnt.fetchAndAddOrdered(-1);
+		return 0;
+	}
+	//ids stay positive, 0 means not waiting
+	_lastWaiter = (_lastWaiter == INT_MAX) ? 1 : _lastWaiter + 1;
+	_waiters.insert(_lastWaiter, fn);
+	return _lastWaiter;
+}
+
+void ResultMemory::removeWaiter(int id)
+{
+	QMutexLocker locker(&_waitMutex);
+	if (_waiters.remove(id) > 0) {
+		_waiterCnt.fetchAndAddOrdered(-1);
+	}
+}
+
+void ResultMemory::wakeWaiters()
+{
+	//ordered with the count in waitForBudget(), no waiter is missed
+	if (_waiterCnt.fetchAndAddOrdered(0) == 0) {
+		return;
+	}
+
+	QList<std::function<void()>> waiters;
+	{
+		QMutexLocker locker(&_waitMutex);
+		if (isOverBudget()) {
+			return;
+		}
+		waiters = _waiters.values();
+		_waiterCnt.fetchAndAddOrdered(-_waiters.size());
+		_waiters.clear();
+	}
+
+	//called outside of the locked area, they may wait again
+	for (int ii = 0; ii < waiters.size(); ii++) {
+		waiters.at(ii)();
+	}
+}
+
+ResultMemoryToken::ResultMemoryToken(qint64 bytes)
+	: _bytes(bytes)
+{
+	ResultMemory::_liveBytes.fetchAndAddRelaxed(_bytes);
+	ResultMemory::_liveResults.fetchAndAddRelaxed(1);
+}
+
+ResultMemoryToken::~ResultMemoryToken()
+{
+	ResultMemory::_liveBytes.fetchAndAddOrdered(-_bytes);
+	ResultMemory::_liveResults.fetchAndAddRelaxed(-1);
+	//held back queries are started as soon as the bytes are within the budget
+	ResultMemory::wakeWaiters();
+}
+
+qint64 ResultMemoryToken::bytes() const
+{
+	return _bytes;
+}
+
+}	//	namespace
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QMap>
+#include <QMutex>
+
+#include <functional>
+
+namespace Database {
+
+/**
+ * @brief Accounts the memory held by all AsyncQueryResult objects of the process.
+ *
+ * @details Every result fetched in memory carries an estimate of its size (see
+ * AsyncQueryResult::memoryUsage()). The bytes are counted while any copy of the result
+ * is alive. Spilled results are memory mapped and not counted.
+ *
+ * If a budget is set and the live bytes exceed it, new read-only queries of
+ * AsyncQuery are held back before a task is created for them, until results are
+ * released (see waitForBudget()) but at most a few seconds. They keep their place
+ * like a retried query (see AsyncQuery::setRetryPolicy()). Writing statements,
+ * scripts, exports and queries of exempt objects (see
+ * AsyncQuery::setResultBudgetExempt()) are not held back. The budget complements
+ * AsyncQuery::setGlobalMemoryLimit(), which limits results while they are fetched.
+ *
+ * The values are also available as properties of the ConnectionManager.
+ */
+class ResultMemory
+{
+public:
+	/**
+	 * @brief Bytes held by live results.
+	 */
+	static qint64 liveBytes();
+
+	/**
+	 * @brief Number of live results which are counted.
+	 */
+	static int liveResults();
+
+	/**
+	 * @brief Set the budget of live result bytes. A value of 0 (default) disables
+	 * the budget.
+	 */
+	static void setBudget(qint64 bytes);
+	static qint64 budget();
+
+	/**
+	 * @brief Returns \c true if a budget is set and the live bytes exceed it.
+	 */
+	static bool isOverBudget();
+
+	/**
+	 * @brief Calls fn once, when the live bytes are within the budget again.
+	 * @details fn is called in the thread releasing a result or changing the budget,
+	 * it should only dispatch work. Waiters are called in the order they were added.
+	 * @returns Id for removeWaiter(), 0 if the live bytes are within the budget
+	 * already, fn is not called then.
+	 */
+	static int waitForBudget(const std::function<void()> &fn);
+
+	/**
+	 * @brief Removes a waiter which was not called yet.
+	 */
+	static void removeWaiter(int id);
+
+private:
+	friend class ResultMemoryToken;
+
+	/* calls the waiters if the live bytes are within the budget */
+	static void wakeWaiters();
+
+	static QAtomicInteger<qint64> _liveBytes;
+	static QAtomicInt _liveResults;
+	static QAtomicInteger<qint64> _budget;
+
+	static QMutex _waitMutex;
+	/* waiters by id, in the order they were added */
+	static QMap<int, std::function<void()>> _waiters;
+	static int _lastWaiter;
+	/* number of waiters, checked without lock when a result is released */
+	static QAtomicInt _waiterCnt;
+};
+
+/**
+ * @brief Counts the bytes of a result while it exists. Shared by all copies of the
+ * result.
+ */
+class ResultMemoryToken
+{
+public:
+	explicit ResultMemoryToken(qint64 bytes);
+	virtual ~ResultMemoryToken();
+
+	qint64 bytes() const;
+
+private:
+	qint64 _bytes;
+};
+
+}	//	namespace
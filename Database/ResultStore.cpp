@@ -0,0 +1,465 @@
+#include "ResultStore.h"
+
+#include <QDataStream>
+#include <QDate>
+#include <QDateTime>
+#include <QDir>
+#include <QTemporaryFile>
+#include <QTime>
+#include <QTimeZone>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace Database {
+
+namespace {
+
+/* rows are written to disk in chunks of this size */
+const int FlushSize = 1024 * 1024;
+
+template <typename T>
+void appendLE(QByteArray *out, T val)
+{
+	uchar buf[sizeof(T)];
+	qToLittleEndian<T>(val, buf);
+	out->append(reinterpret_cast<const char*>(buf), sizeof(T));
+}
+
+}
+
+ResultStore::ResultStore(int columns)
+	: _columns(columns)
+	, _size(0)
+	, _map(nullptr)
+	, _mapped(false)
+	, _end(0)
+{
+}
+
+ResultStore::~ResultStore()
+{
+	if (_mapped) {
+		_file->unmap(_map);
+	}
+}
+
+bool ResultStore::open()
+{
+	Q_ASSERT(!_file);
+	QTemporaryFile *file = new QTemporaryFile(QDir::tempPath() + "/AsyncQueryResult.XXXXXX");
+	_file.reset(file);
+	_buffer.reserve(FlushSize);
+	return file->open();
+}
+
+bool ResultStore::mapFile(const QString &fileName)
+{
+	Q_ASSERT(!_file);
+	_file.reset(new QFile(fileName));
+	if (!_file->open(QIODevice::ReadOnly)) {
+		return false;
+	}
+	_size = _file->size();
+	if (_size == 0) {
+		return true;
+	}
+	_map = _file->map(0, _size);
+	if (_map != nullptr) {
+		_mapped = true;
+		return true;
+	}
+	_fallback = _file->readAll();
+	_map = reinterpret_cast<uchar*>(_fallback.data());
+	return _fallback.size() == _size;
+}
+
+void ResultStore::setData(const QByteArray &data)
+{
+	Q_ASSERT(!_file);
+	_fallback = data;
+	_size = data.size();
+	//never written, so the shared buffer is not detached
+	_map = reinterpret_cast<uchar*>(const_cast<char*>(_fallback.constData()));
+}
+
+void ResultStore::setRows(int columns, const QVector<qint64> &offsets, qint64 end)
+{
+	_columns = columns;
+	_offsets = offsets;
+	_end = end;
+	_rowState.reset(new QAtomicInt[offsets.size()]);
+}
+
+const uchar *ResultStore::data() const
+{
+	return _map;
+}
+
+bool ResultStore::appendRow(const QVector<QVariant> &row)
+{
+	Q_ASSERT(_map == nullptr);
+	_offsets.append(_size + _buffer.size());
+	encodeRow(row, &_buffer);
+	if (_buffer.size() >= FlushSize) {
+		return flush();
+	}
+	return true;
+}
+
+bool ResultStore::flush()
+{
+	if (_buffer.isEmpty()) {
+		return true;
+	}
+	qint64 written = _file->write(_buffer);
+	if (written != _buffer.size()) {
+		return false;
+	}
+	_size += written;
+	_buffer.resize(0);
+	return true;
+}
+
+bool ResultStore::finish()
+{
+	if (!flush() || !_file->flush()) {
+		return false;
+	}
+	_buffer = QByteArray();
+	if (_size == 0) {
+		return true;
+	}
+
+	_map = _file->map(0, _size);
+	if (_map != nullptr) {
+		_mapped = true;
+		return true;
+	}
+
+	//mapping not supported, fall back to reading the file into memory
+	_file->seek(0);
+	_fallback = _file->readAll();
+	if (_fallback.size() != _size) {
+		return false;
+	}
+	_map = reinterpret_cast<uchar*>(_fallback.data());
+	return true;
+}
+
+int ResultStore::count() const
+{
+	return _offsets.size();
+}
+
+qint64 ResultStore::size() const
+{
+	return _size + _buffer.size();
+}
+
+QVariant ResultStore::value(int row, int col) const
+{
+	Q_ASSERT(_map != nullptr);
+	if (!checkRow(row)) {
+		return QVariant();
+	}
+	return decodeValue(_map + _offsets[row], _columns, col);
+}
+
+QVector<QVariant> ResultStore::row(int row) const
+{
+	QVector<QVariant> ret(_columns);
+	if (!checkRow(row)) {
+		return ret;
+	}
+	for (int ii = 0; ii < _columns; ii++) {
+		ret[ii] = decodeValue(_map + _offsets[row], _columns, ii);
+	}
+	return ret;
+}
+
+bool ResultStore::checkRow(int row) const
+{
+	//own rows are trusted
+	if (_rowState.isNull()) {
+		return true;
+	}
+	QAtomicInt &state = _rowState[row];
+	int current = state.loadAcquire();
+	if (current == 0) {
+		//racing readers compute the same result, so a plain store is enough
+		const qint64 end = (row + 1 < _offsets.size()) ? _offsets.at(row + 1) : _end;
+		current = isValidRow(_map + _offsets.at(row), end - _offsets.at(row), _columns) ? 1 : 2;
+		state.storeRelease(current);
+	}
+	return current == 1;
+}
+
+void ResultStore::encodeRow(const QVector<QVariant> &row, QByteArray *out)
+{
+	const int cols = row.size();
+	const int bitmapSize = (cols + 7) / 8;
+	const int start = out->size();
+	const int valueStart = start + bitmapSize + cols + cols * 4;
+
+	out->resize(valueStart);
+	std::memset(out->data() + start, 0, valueStart - start);
+
+	for (int ii = 0; ii < cols; ii++) {
+		const QVariant &v = row.at(ii);
+		CellType type = Cell_Null;
+
+		if (v.isValid()) {
+			switch (v.userType()) {
+			case QMetaType::Bool:
+				type = Cell_Bool;
+				out->append(v.toBool() ? '\1' : '\0');
+				break;
+			case QMetaType::Int:
+				type = Cell_Int;
+				appendLE<qint32>(out, v.toInt());
+				break;
+			case QMetaType::UInt:
+				type = Cell_UInt;
+				appendLE<quint32>(out, v.toUInt());
+				break;
+			case QMetaType::LongLong:
+				type = Cell_LongLong;
+				appendLE<qint64>(out, v.toLongLong());
+				break;
+			case QMetaType::ULongLong:
+				type = Cell_ULongLong;
+				appendLE<quint64>(out, v.toULongLong());
+				break;
+			case QMetaType::Double: {
+				type = Cell_Double;
+				double d = v.toDouble();
+				quint64 bits;
+				std::memcpy(&bits, &d, sizeof(bits));
+				appendLE<quint64>(out, bits);
+				break;
+			}
+			case QMetaType::QString: {
+				type = Cell_String;
+				const QString s = v.toString();
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+				out->append(reinterpret_cast<const char*>(s.utf16()), s.size() * 2);
+#else
+				for (int jj = 0; jj < s.size(); jj++) {
+					appendLE<quint16>(out, s.at(jj).unicode());
+				}
+#endif
+				break;
+			}
+			case QMetaType::QByteArray:
+				type = Cell_ByteArray;
+				out->append(v.toByteArray());
+				break;
+			case QMetaType::QDate:
+				type = Cell_Date;
+				appendLE<qint64>(out, v.toDate().toJulianDay());
+				break;
+			case QMetaType::QTime:
+				type = Cell_Time;
+				appendLE<qint32>(out, v.toTime().msecsSinceStartOfDay());
+				break;
+			case QMetaType::QDateTime: {
+				type = Cell_DateTime;
+				//msecs, time spec, then the offset in seconds or the IANA id of the zone
+				const QDateTime dt = v.toDateTime();
+				appendLE<qint64>(out, dt.toMSecsSinceEpoch());
+				out->append(static_cast<char>(dt.timeSpec()));
+				if (dt.timeSpec() == Qt::OffsetFromUTC) {
+					appendLE<qint32>(out, dt.offsetFromUtc());
+				} else if (dt.timeSpec() == Qt::TimeZone) {
+					out->append(dt.timeZone().id());
+				}
+				break;
+			}
+			default: {
+				type = Cell_Variant;
+				QByteArray raw;
+				QDataStream ds(&raw, QIODevice::WriteOnly);
+				ds.setVersion(QDataStream::Qt_5_5);
+				ds << v;
+				out->append(raw);
+				break;
+			}
+			}
+		}
+
+		uchar *head = reinterpret_cast<uchar*>(out->data()) + start;
+		if (type == Cell_Null) {
+			head[ii / 8] |= (1 << (ii % 8));
+		}
+		head[bitmapSize + ii] = static_cast<uchar>(type);
+		qToLittleEndian<quint32>(out->size() - valueStart,
+								 head + bitmapSize + cols + ii * 4);
+	}
+}
+
+QVariant ResultStore::decodeValue(const uchar *row, int columns, int col)
+{
+	const int bitmapSize = (columns + 7) / 8;
+	if (row[col / 8] & (1 << (col % 8))) {
+		return QVariant();
+	}
+
+	const uchar *ends = row + bitmapSize + columns;
+	const quint32 begin = (col > 0) ? qFromLittleEndian<quint32>(ends + (col - 1) * 4) : 0;
+	const quint32 end = qFromLittleEndian<quint32>(ends + col * 4);
+	const uchar *p = ends + columns * 4 + begin;
+	const int len = end - begin;
+
+	switch (row[bitmapSize + col]) {
+	case Cell_Bool:
+		return QVariant(*p != 0);
+	case Cell_Int:
+		return QVariant(qFromLittleEndian<qint32>(p));
+	case Cell_UInt:
+		return QVariant(qFromLittleEndian<quint32>(p));
+	case Cell_LongLong:
+		return QVariant(qFromLittleEndian<qint64>(p));
+	case Cell_ULongLong:
+		return QVariant(qFromLittleEndian<quint64>(p));
+	case Cell_Double: {
+		quint64 bits = qFromLittleEndian<quint64>(p);
+		double d;
+		std::memcpy(&d, &bits, sizeof(d));
+		return QVariant(d);
+	}
+	case Cell_String: {
+		QString s(len / 2, Qt::Uninitialized);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+		std::memcpy(s.data(), p, len);
+#else
+		for (int jj = 0; jj < s.size(); jj++) {
+			s[jj] = QChar(qFromLittleEndian<quint16>(p + jj * 2));
+		}
+#endif
+		return QVariant(s);
+	}
+	case Cell_ByteArray:
+		return QVariant(QByteArray(reinterpret_cast<const char*>(p), len));
+	case Cell_Date:
+		return QVariant(QDate::fromJulianDay(qFromLittleEndian<qint64>(p)));
+	case Cell_Time:
+		return QVariant(QTime::fromMSecsSinceStartOfDay(qFromLittleEndian<qint32>(p)));
+	case Cell_DateTime: {
+		qint64 msecs = qFromLittleEndian<qint64>(p);
+		//rows written without offset or zone are shown in local time
+		switch (static_cast<Qt::TimeSpec>(p[8])) {
+		case Qt::UTC:
+			return QVariant(QDateTime::fromMSecsSinceEpoch(msecs, Qt::UTC));
+		case Qt::OffsetFromUTC:
+			if (len >= 13) {
+				return QVariant(QDateTime::fromMSecsSinceEpoch(
+									msecs, Qt::OffsetFromUTC, qFromLittleEndian<qint32>(p + 9)));
+			}
+			break;
+		case Qt::TimeZone: {
+			QTimeZone zone(QByteArray(reinterpret_cast<const char*>(p + 9), len - 9));
+			if (zone.isValid()) {
+				return QVariant(QDateTime::fromMSecsSinceEpoch(msecs, zone));
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return QVariant(QDateTime::fromMSecsSinceEpoch(msecs));
+	}
+	case Cell_Variant: {
+		QByteArray raw = QByteArray::fromRawData(reinterpret_cast<const char*>(p), len);
+		QDataStream ds(raw);
+		ds.setVersion(QDataStream::Qt_5_5);
+		QVariant v;
+		ds >> v;
+		return v;
+	}
+	default:
+		return QVariant();
+	}
+}
+
+bool ResultStore::isValidRow(const uchar *row, qint64 size, int columns)
+{
+	const int bitmapSize = (columns + 7) / 8;
+	const qint64 headSize = bitmapSize + qint64(columns) * 5;
+	if (columns < 0 || size < headSize) {
+		return false;
+	}
+
+	const uchar *ends = row + bitmapSize + columns;
+	quint32 begin = 0;
+	for (int ii = 0; ii < columns; ii++) {
+		const quint32 end = qFromLittleEndian<quint32>(ends + ii * 4);
+		if (end < begin || end > quint64(size - headSize)) {
+			return false;
+		}
+		const quint32 len = end - begin;
+		begin = end;
+
+		if (row[ii / 8] & (1 << (ii % 8))) {
+			continue;
+		}
+		//fixed size types are decoded without looking at the length
+		bool ok;
+		switch (row[bitmapSize + ii]) {
+		case Cell_Null:
+		case Cell_ByteArray:
+		case Cell_Variant:
+			ok = true;
+			break;
+		case Cell_Bool:
+			ok = len >= 1;
+			break;
+		case Cell_Int:
+		case Cell_UInt:
+		case Cell_Time:
+			ok = len >= 4;
+			break;
+		case Cell_LongLong:
+		case Cell_ULongLong:
+		case Cell_Double:
+		case Cell_Date:
+			ok = len >= 8;
+			break;
+		case Cell_DateTime:
+			ok = len >= 9;
+			break;
+		case Cell_String:
+			ok = (len % 2) == 0;
+			break;
+		default:
+			ok = false;
+			break;
+		}
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+qint64 ResultStore::estimateSize(const QVector<QVariant> &row)
+{
+	//vector header plus the variants themselves
+	qint64 bytes = 32 + row.size() * qint64(sizeof(QVariant));
+	for (int ii = 0; ii < row.size(); ii++) {
+		const QVariant &v = row.at(ii);
+		switch (v.userType()) {
+		case QMetaType::QString:
+			bytes += 32 + static_cast<const QString*>(v.constData())->size() * 2;
+			break;
+		case QMetaType::QByteArray:
+			bytes += 32 + static_cast<const QByteArray*>(v.constData())->size();
+			break;
+		default:
+			break;
+		}
+	}
+	return bytes;
+}
+
+}	//	namespace
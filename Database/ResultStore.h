@@ -0,0 +1,157 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QScopedPointer>
+#include <QVariant>
+#include <QVector>
+
+namespace Database {
+
+/**
+ * @brief Compact binary storage of result rows in a memory mapped file.
+ *
+ * @details Rows are appended with appendRow() to a temporary file. After finish()
+ * the file is memory mapped and values are decoded lazily on access. A row is
+ * encoded as follows (all numbers little endian):
+ *
+ * | part          | size                 | content                                |
+ * |---------------|----------------------|----------------------------------------|
+ * | null bitmap   | (columns + 7) / 8    | bit set if the cell is null            |
+ * | cell types    | columns              | CellType of each cell                  |
+ * | end offsets   | columns * 4          | end of each value, relative to values  |
+ * | values        | variable             | encoded cell values                    |
+ *
+ * A single value can therefore be decoded without parsing the other cells of the row.
+ *
+ * Besides spilling, a ResultStore can be attached to rows in an existing file with
+ * mapFile() or to a buffer with setData(). The row offsets are then set with setRows().
+ * Such rows come from outside and are checked with isValidRow() the first time they are
+ * accessed, a corrupt row reads as null values.
+ *
+ * @note After finish() the object is read only and can be used from several threads.
+ */
+class ResultStore
+{
+public:
+	/** @brief Type tag of an encoded cell. */
+	typedef enum CellType {
+		Cell_Null = 0,
+		Cell_Bool,
+		Cell_Int,
+		Cell_UInt,
+		Cell_LongLong,
+		Cell_ULongLong,
+		Cell_Double,
+		Cell_String,
+		Cell_ByteArray,
+		Cell_Date,
+		Cell_Time,
+		Cell_DateTime,
+		Cell_Variant,
+	} CellType;
+
+	explicit ResultStore(int columns = 0);
+	virtual ~ResultStore();
+
+	/**
+	 * @brief Creates the temporary file.
+	 * @returns \c true on success
+	 */
+	bool open();
+
+	/**
+	 * @brief Appends a row. Only valid before finish() is called.
+	 */
+	bool appendRow(const QVector<QVariant> &row);
+
+	/**
+	 * @brief Flushes all rows and maps the file into memory.
+	 */
+	bool finish();
+
+	/**
+	 * @brief Maps an existing file read only into memory.
+	 */
+	bool mapFile(const QString &fileName);
+
+	/**
+	 * @brief Uses the given buffer as data.
+	 */
+	void setData(const QByteArray &data);
+
+	/**
+	 * @brief Sets the number of columns and the start offsets of all rows in the
+	 * mapped file or buffer, end is the offset behind the last row.
+	 * @note The offsets have to be ascending and lie within the data, the rows
+	 * themselves are validated lazily.
+	 */
+	void setRows(int columns, const QVector<qint64> &offsets, qint64 end);
+
+	/**
+	 * @brief Returns the mapped file or buffer, \c nullptr if nothing is mapped.
+	 */
+	const uchar *data() const;
+
+	/**
+	 * @brief Number of stored rows.
+	 */
+	int count() const;
+
+	/**
+	 * @brief Number of bytes used on disk.
+	 */
+	qint64 size() const;
+
+	/**
+	 * @brief Returns the decoded value of given row and column.
+	 * @note row and col have to be valid.
+	 */
+	QVariant value(int row, int col) const;
+
+	/**
+	 * @brief Returns all decoded values of given row.
+	 */
+	QVector<QVariant> row(int row) const;
+
+	/**
+	 * @brief Encodes a row and appends it to out.
+	 */
+	static void encodeRow(const QVector<QVariant> &row, QByteArray *out);
+
+	/**
+	 * @brief Decodes column col of an encoded row with given number of columns.
+	 */
+	static QVariant decodeValue(const uchar *row, int columns, int col);
+
+	/**
+	 * @brief Returns \c true if the encoded row with given number of columns lies
+	 * within size bytes and all its cells can be decoded safely.
+	 */
+	static bool isValidRow(const uchar *row, qint64 size, int columns);
+
+	/**
+	 * @brief Estimated number of bytes a row occupies in memory.
+	 */
+	static qint64 estimateSize(const QVector<QVariant> &row);
+
+private:
+	bool flush();
+	bool checkRow(int row) const;
+
+private:
+	int _columns;
+	QScopedPointer<QFile> _file;
+	QByteArray _buffer;
+	QVector<qint64> _offsets;
+	qint64 _size;
+	uchar *_map;
+	bool _mapped;
+	QByteArray _fallback;
+	/* end of the rows set with setRows() */
+	qint64 _end;
+	/* per row 0 if unchecked, 1 if valid, 2 if corrupt, only for rows set with setRows() */
+	QScopedArrayPointer<QAtomicInt> _rowState;
+};
+
+}	//	namespace
@@ -0,0 +1,121 @@
+#include "RetryPolicy.h"
+
+#include <QtGlobal>
+
+#include <random>
+
+namespace Database {
+
+RetryPolicy::RetryPolicy()
+	: _classes(Retry_Default)
+	, _maxAttempts(1)
+	, _initialMs(10)
+	, _multiplier(2.0)
+	, _maxMs(1000)
+	, _jitter(0.5)
+{
+}
+
+void RetryPolicy::setErrorClasses(int classes)
+{
+	_classes = classes;
+}
+
+int RetryPolicy::errorClasses() const
+{
+	return _classes;
+}
+
+void RetryPolicy::setMaxAttempts(int attempts)
+{
+	_maxAttempts = qMax(1, attempts);
+}
+
+int RetryPolicy::maxAttempts() const
+{
+	return _maxAttempts;
+}
+
+void RetryPolicy::setBackoff(int initialMs, double multiplier, int maxMs)
+{
+	_initialMs = qMax(0, initialMs);
+	_multiplier = qMax(1.0, multiplier);
+	_maxMs = qMax(_initialMs, maxMs);
+}
+
+int RetryPolicy::initialBackoffMs() const
+{
+	return _initialMs;
+}
+
+double RetryPolicy::backoffMultiplier() const
+{
+	return _multiplier;
+}
+
+int RetryPolicy::maxBackoffMs() const
+{
+	return _maxMs;
+}
+
+void RetryPolicy::setJitter(double jitter)
+{
+	_jitter = qBound(0.0, jitter, 1.0);
+}
+
+double RetryPolicy::jitter() const
+{
+	return _jitter;
+}
+
+RetryPolicy::ErrorClass RetryPolicy::classify(const QSqlError &error)
+{
+	if (!error.isValid()) {
+		return Retry_None;
+	}
+
+	const QString code = error.nativeErrorCode();
+	const QString text = error.databaseText().toLower();
+
+	//SQLITE_BUSY, SQLITE_LOCKED, MySQL lock wait timeout
+	if (code == "5" || code == "6" || (code == "1205" && text.contains("lock wait"))
+			|| text.contains("database is locked") || text.contains("table is locked")) {
+		return Retry_Busy;
+	}
+	if (code == "40P01" || code == "1213" || code == "1205" || text.contains("deadlock")) {
+		return Retry_Deadlock;
+	}
+	if (code == "40001" || text.contains("could not serialize")) {
+		return Retry_Serialization;
+	}
+	if (error.type() == QSqlError::ConnectionError) {
+		return Retry_Connection;
+	}
+	return Retry_None;
+}
+
+bool RetryPolicy::isTransient(const QSqlError &error) const
+{
+	ErrorClass cls = classify(error);
+	return (cls != Retry_None) && (_classes & cls);
+}
+
+int RetryPolicy::backoffMs(int retry) const
+{
+	double delay = _initialMs;
+	for (int ii = 1; ii < retry && delay < _maxMs; ii++) {
+		delay *= _multiplier;
+	}
+	delay = qMin(delay, double(_maxMs));
+
+	if (_jitter <= 0.0) {
+		return int(delay);
+	}
+
+	//each thread has its own generator, seeded differently
+	static thread_local std::mt19937 generator(std::random_device{}());
+	std::uniform_real_distribution<double> dist(0.0, _jitter);
+	return int(delay * (1.0 - dist(generator)));
+}
+
+}	//	namespace
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <QSqlError>
+
+namespace Database {
+
+/**
+ * @brief Defines which errors of a query are transient and how the query is retried.
+ *
+ * @details A query failing with a transient error is executed again after a backoff
+ * delay, which grows exponentially with each attempt and is randomized by the jitter
+ * to avoid retry storms of competing writers. Waiting for the next attempt does not
+ * block a thread of the pool. See AsyncQuery::setRetryPolicy().
+ *
+ * The default policy retries nothing (maxAttempts() is 1).
+ */
+class RetryPolicy
+{
+public:
+	/**
+	 * @brief Classes of transient errors, can be combined.
+	 */
+	typedef enum ErrorClass {
+		Retry_None = 0x00,
+		/** SQLite SQLITE_BUSY/SQLITE_LOCKED ("database is locked"), MySQL lock wait
+		 * timeout. */
+		Retry_Busy = 0x01,
+		/** Deadlock detected by the server (PostgreSQL 40P01, MySQL 1213, SQL Server
+		 * 1205). */
+		Retry_Deadlock = 0x02,
+		/** Serialization failure of a transaction (PostgreSQL 40001). */
+		Retry_Serialization = 0x04,
+		/** Any QSqlError::ConnectionError. */
+		Retry_Connection = 0x08,
+		Retry_Default = Retry_Busy | Retry_Deadlock | Retry_Serialization,
+	} ErrorClass;
+
+	RetryPolicy();
+
+	/**
+	 * @brief Set the error classes which are retried. Default is Retry_Default.
+	 */
+	void setErrorClasses(int classes);
+	int errorClasses() const;
+
+	/**
+	 * @brief Set the maximum number of executions of a query including the first one.
+	 * A value of 1 (default) disables retries.
+	 */
+	void setMaxAttempts(int attempts);
+	int maxAttempts() const;
+
+	/**
+	 * @brief Set the delay before the first retry, the factor it grows with each
+	 * retry and its upper limit. Default is 10 ms, factor 2, at most 1000 ms.
+	 */
+	void setBackoff(int initialMs, double multiplier, int maxMs);
+	int initialBackoffMs() const;
+	double backoffMultiplier() const;
+	int maxBackoffMs() const;
+
+	/**
+	 * @brief Set the jitter between 0 and 1. The delay is reduced randomly by up to
+	 * this fraction. Default is 0.5.
+	 */
+	void setJitter(double jitter);
+	double jitter() const;
+
+	/**
+	 * @brief Returns the error class of error, Retry_None if it is not transient.
+	 */
+	static ErrorClass classify(const QSqlError &error);
+
+	/**
+	 * @brief Returns \c true if error belongs to a retried error class.
+	 */
+	bool isTransient(const QSqlError &error) const;
+
+	/**
+	 * @brief Randomized delay in ms before retry number retry (starting at 1).
+	 */
+	int backoffMs(int retry) const;
+
+private:
+	int _classes;
+	int _maxAttempts;
+	int _initialMs;
+	double _multiplier;
+	int _maxMs;
+	double _jitter;
+};
+
+}	//	namespace
@@ -0,0 +1,214 @@
+#include "SchemaCatalog.h"
+#include "ConnectionManager.h"
+
+#include <QMap>
+#include <QRunnable>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QThreadPool>
+
+namespace Database {
+
+/* shared between the catalog and its load task, the catalog pointer is reset when the
+ * catalog is destroyed */
+struct CatalogTokenPrivate {
+	QMutex mutex;
+	SchemaCatalog *catalog;
+};
+
+namespace {
+
+QList<IndexInfo> sqliteIndexes(const QSqlDatabase &db, const QString &table)
+{
+	QList<IndexInfo> ret;
+	QSqlDriver *driver = db.driver();
+
+	QSqlQuery list = QSqlQuery(db);
+	list.exec(QString("PRAGMA index_list(%1)")
+			  .arg(driver->escapeIdentifier(table, QSqlDriver::TableName)));
+	while (list.next()) {
+		IndexInfo index;
+		index.name = list.value("name").toString();
+		index.unique = list.value("unique").toBool();
+
+		QSqlQuery info = QSqlQuery(db);
+		info.exec(QString("PRAGMA index_info(%1)")
+				  .arg(driver->escapeIdentifier(index.name, QSqlDriver::TableName)));
+		while (info.next()) {
+			index.columns << info.value("name").toString();
+		}
+		ret << index;
+	}
+	return ret;
+}
+
+QList<IndexInfo> mysqlIndexes(const QSqlDatabase &db, const QString &table)
+{
+	//one row per column, ordered by index and position
+	QList<IndexInfo> ret;
+	QSqlQuery query = QSqlQuery(db);
+	query.exec(QString("SHOW INDEX FROM %1")
+			   .arg(db.driver()->escapeIdentifier(table, QSqlDriver::TableName)));
+	while (query.next()) {
+		QString name = query.value("Key_name").toString();
+		if (ret.isEmpty() || ret.last().name != name) {
+			IndexInfo index;
+			index.name = name;
+			index.unique = (query.value("Non_unique").toInt() == 0);
+			ret << index;
+		}
+		ret.last().columns << query.value("Column_name").toString();
+	}
+	return ret;
+}
+
+}
+
+/* reads the schema on the connection of its pool thread */
+class SchemaLoadTaskPrivate : public QRunnable
+{
+public:
+	SchemaLoadTaskPrivate(const QSharedPointer<CatalogTokenPrivate> &token, int generation)
+		: _token(token)
+		, _generation(generation)
+	{
+	}
+
+	void run() override
+	{
+		ConnectionManager* conmgr = ConnectionManager::instance();
+		if (!conmgr->connectionExists()) {
+			conmgr->open();
+		}
+		QSqlDatabase db = conmgr->threadConnection();
+
+		QStringList names = db.tables(QSql::Tables);
+		QHash<QString, TableInfo> tables;
+		for (int ii = 0; ii < names.size(); ii++) {
+			TableInfo info;
+			info.name = names.at(ii);
+			info.record = db.record(info.name);
+			info.primaryKey = db.primaryIndex(info.name);
+			if (db.driverName() == "QSQLITE") {
+				info.indexes = sqliteIndexes(db, info.name);
+			} else if (db.driverName() == "QMYSQL") {
+				info.indexes = mysqlIndexes(db, info.name);
+			}
+			tables.insert(info.name.toLower(), info);
+		}
+
+		QMutexLocker locker(&_token->mutex);
+		if (_token->catalog != nullptr) {
+			_token->catalog->loadDone(_generation, names, tables);
+		}
+	}
+
+private:
+	QSharedPointer<CatalogTokenPrivate> _token;
+	int _generation;
+};
+
+
+SchemaCatalog::SchemaCatalog(QObject *parent)
+	: QObject(parent)
+	, logger("Database.SchemaCatalog")
+	, _token(new CatalogTokenPrivate)
+	, _generation(0)
+	, _loaded(false)
+	, _loading(false)
+{
+	_token->catalog = this;
+}
+
+SchemaCatalog::~SchemaCatalog()
+{
+	//a running load task must not deliver to this catalog anymore
+	QMutexLocker locker(&_token->mutex);
+	_token->catalog = nullptr;
+}
+
+void SchemaCatalog::load()
+{
+	QMutexLocker locker(&_mutex);
+	if (_loaded || _loading) {
+		return;
+	}
+	startLoad();
+}
+
+void SchemaCatalog::invalidate()
+{
+	QMutexLocker locker(&_mutex);
+	//results of running loads are outdated
+	_generation++;
+	bool reload = _loaded || _loading;
+	_loaded = false;
+	if (reload) {
+		startLoad();
+	}
+}
+
+bool SchemaCatalog::isLoaded() const
+{
+	QMutexLocker locker(&_mutex);
+	return _loaded;
+}
+
+QStringList SchemaCatalog::tables() const
+{
+	QMutexLocker locker(&_mutex);
+	return _names;
+}
+
+bool SchemaCatalog::hasTable(const QString &table) const
+{
+	QMutexLocker locker(&_mutex);
+	return _tables.contains(table.toLower());
+}
+
+TableInfo SchemaCatalog::table(const QString &table) const
+{
+	QMutexLocker locker(&_mutex);
+	return _tables.value(table.toLower());
+}
+
+QSqlRecord SchemaCatalog::record(const QString &table) const
+{
+	return this->table(table).record;
+}
+
+QStringList SchemaCatalog::primaryKey(const QString &table) const
+{
+	QSqlIndex index = this->table(table).primaryKey;
+	QStringList ret;
+	for (int ii = 0; ii < index.count(); ii++) {
+		ret << index.fieldName(ii);
+	}
+	return ret;
+}
+
+void SchemaCatalog::startLoad()
+{
+	_loading = true;
+	QThreadPool::globalInstance()->start(new SchemaLoadTaskPrivate(_token, _generation));
+}
+
+void SchemaCatalog::loadDone(int generation, const QStringList &names,
+							 const QHash<QString, TableInfo> &tables)
+{
+	{
+		QMutexLocker locker(&_mutex);
+		if (generation != _generation) {
+			//invalidated meanwhile, the reload delivers
+			return;
+		}
+		_names = names;
+		_tables = tables;
+		_loaded = true;
+		_loading = false;
+	}
+	qCDebug(logger) << "Loaded" << names.size() << "tables";
+	emit loaded();
+}
+
+}	//	namespace
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QSqlIndex>
+#include <QSqlRecord>
+#include <QString>
+#include <QStringList>
+
+namespace Database {
+
+// class forward decl's
+struct CatalogTokenPrivate;
+class SchemaLoadTaskPrivate;
+
+/**
+ * @brief Describes an index of a table.
+ */
+typedef struct IndexInfo {
+	QString name;
+	/** Indexed columns in index order. */
+	QStringList columns;
+	bool unique;
+} IndexInfo;
+
+/**
+ * @brief Describes a table of the schema catalog.
+ */
+typedef struct TableInfo {
+	/** Name as reported by the database. */
+	QString name;
+	/** Columns with name, type, required status and default value. */
+	QSqlRecord record;
+	/** Columns of the primary key, empty if the table has none. */
+	QSqlIndex primaryKey;
+	/** Secondary indexes, only read for QSQLITE and QMYSQL. */
+	QList<IndexInfo> indexes;
+} TableInfo;
+
+/**
+ * @brief Cached schema of the database: tables, columns, types, primary keys and
+ * indexes.
+ *
+ * @details The catalog is loaded once in the global thread pool, on the connection of
+ * the pool thread, and can be read from any thread without blocking on the database.
+ * DDL executed through AsyncQuery invalidates it (see
+ * ConnectionManager::notifySchemaChanged()), a loaded catalog is then reloaded in the
+ * background. Until the reload is finished isLoaded() is \c false and the lookups
+ * return the previous schema.
+ *
+ * The catalog is maintained by the ConnectionManager (see
+ * ConnectionManager::schemaCatalog()). Table names are looked up case insensitive.
+ */
+class SchemaCatalog : public QObject
+{
+	Q_OBJECT
+
+	friend class SchemaLoadTaskPrivate;
+
+public:
+	explicit SchemaCatalog(QObject *parent = nullptr);
+	virtual ~SchemaCatalog();
+
+	/**
+	 * @brief Starts loading the catalog if it is neither loaded nor loading.
+	 */
+	void load();
+
+	/**
+	 * @brief Discards the loaded schema, a loaded or loading catalog is reloaded.
+	 */
+	void invalidate();
+
+	/**
+	 * @brief Returns \c true if the catalog is loaded and up to date.
+	 */
+	bool isLoaded() const;
+
+	/**
+	 * @brief Names of all tables, in the order reported by the database.
+	 */
+	QStringList tables() const;
+	bool hasTable(const QString &table) const;
+
+	/**
+	 * @brief Returns the description of table, an empty TableInfo if it is unknown.
+	 */
+	TableInfo table(const QString &table) const;
+
+	/**
+	 * @brief Convenience functions for the parts of table().
+	 */
+	QSqlRecord record(const QString &table) const;
+	QStringList primaryKey(const QString &table) const;
+
+signals:
+	/**
+	 * @brief Is emitted when the catalog was loaded or reloaded.
+	 * @note Is emitted from the loading thread.
+	 */
+	void loaded();
+
+private:
+	void startLoad();
+	/* called by the load task, tables are keyed by lower case name */
+	void loadDone(int generation, const QStringList &names,
+				  const QHash<QString, TableInfo> &tables);
+
+private:
+	QLoggingCategory logger;
+	QSharedPointer<CatalogTokenPrivate> _token;
+	mutable QMutex _mutex;
+	int _generation;
+	bool _loaded;
+	bool _loading;
+	QStringList _names;
+	QHash<QString, TableInfo> _tables;
+};
+
+}	//	namespace
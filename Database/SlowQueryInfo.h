@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QMap>
+#include <QMetaType>
+#include <QString>
+#include <QVariant>
+
+namespace Database {
+
+/**
+ * @brief Describes a query which exceeded the slow query threshold of a AsyncQuery.
+ * @see AsyncQuery::setSlowQueryThresholdMs()
+ */
+typedef struct SlowQueryInfo {
+	/** The sql statement. */
+	QString query;
+	/** The bound values, values are replaced if redaction is enabled. */
+	QMap<QString, QVariant> boundValues;
+	/** Time in ms to prepare, execute and fetch the query. */
+	qint64 prepareMs;
+	qint64 execMs;
+	qint64 fetchMs;
+	/** Number of fetched rows. */
+	int rowCount;
+	/** The query plan as reported by EXPLAIN QUERY PLAN (SQLite) or EXPLAIN, one
+	 * line per plan row. Empty if the plan could not be retrieved. */
+	QString plan;
+} SlowQueryInfo;
+
+}	//	namespace
+
+Q_DECLARE_METATYPE(Database::SlowQueryInfo)
@@ -0,0 +1,329 @@
+#include "SqlStatement.h"
+
+namespace Database {
+
+QStringList SqlStatement::tables(const QString &sql)
+{
+	QList<Token> tokens = tokenize(sql);
+	QStringList ret;
+
+	for (int ii = 0; ii < tokens.size(); ii++) {
+		const Token &tok = tokens.at(ii);
+		bool list = isKeyword(tok, "FROM");
+		if (!list && !isKeyword(tok, "JOIN") && !isKeyword(tok, "INTO")
+				&& !isKeyword(tok, "UPDATE") && !isKeyword(tok, "TABLE")) {
+			continue;
+		}
+
+		int pos = ii + 1;
+		forever {
+			//skip IF [NOT] EXISTS and UPDATE OR <conflict clause>
+			while (pos < tokens.size() && (isKeyword(tokens.at(pos), "IF")
+					|| isKeyword(tokens.at(pos), "NOT")
+					|| isKeyword(tokens.at(pos), "EXISTS")
+					|| isKeyword(tokens.at(pos), "ONLY"))) {
+				pos++;
+			}
+			if (isKeyword(tok, "UPDATE") && pos + 1 < tokens.size()
+					&& isKeyword(tokens.at(pos), "OR")) {
+				pos += 2;
+			}
+
+			QString name = readName(tokens, &pos);
+			if (name.isEmpty()) {
+				break;
+			}
+			if (!ret.contains(name)) {
+				ret << name;
+			}
+
+			//comma separated FROM list with optional aliases
+			if (!list) {
+				break;
+			}
+			if (pos < tokens.size() && isKeyword(tokens.at(pos), "AS")) {
+				pos++;
+			}
+			if (pos < tokens.size() && tokens.at(pos).isWord
+					&& !isKeyword(tokens.at(pos), "WHERE")
+					&& !isKeyword(tokens.at(pos), "JOIN")) {
+				pos++;
+			}
+			if (pos >= tokens.size() || !isSymbol(tokens.at(pos), ',')) {
+				break;
+			}
+			pos++;
+		}
+	}
+	return ret;
+}
+
+QStringList SqlStatement::writtenTables(const QString &sql)
+{
+	return writtenTables(tokenize(sql));
+}
+
+QStringList SqlStatement::writtenTables(const QString &sql, bool *ddl)
+{
+	QList<Token> tokens = tokenize(sql);
+	*ddl = isDdl(tokens);
+	return writtenTables(tokens);
+}
+
+QStringList SqlStatement::writtenTables(const QList<Token> &tokens)
+{
+	QStringList ret;
+
+	for (int ii = 0; ii < tokens.size(); ii++) {
+		const Token &tok = tokens.at(ii);
+		int pos = -1;
+
+		if (isKeyword(tok, "INTO")) {
+			//INSERT/REPLACE INTO, but not SELECT ... INTO of some dialects
+			for (int jj = ii - 1; jj >= 0 && !isSymbol(tokens.at(jj), ';'); jj--) {
+				if (isKeyword(tokens.at(jj), "INSERT") || isKeyword(tokens.at(jj), "REPLACE")) {
+					pos = ii + 1;
+					break;
+				}
+			}
+		} else if (isKeyword(tok, "UPDATE") || isKeyword(tok, "DELETE")) {
+			//not DO UPDATE, KEY UPDATE, FOR UPDATE, ON DELETE CASCADE or trigger events
+			if (ii > 0 && (isKeyword(tokens.at(ii - 1), "DO")
+					|| isKeyword(tokens.at(ii - 1), "KEY")
+					|| isKeyword(tokens.at(ii - 1), "FOR")
+					|| isKeyword(tokens.at(ii - 1), "ON")
+					|| isKeyword(tokens.at(ii - 1), "BEFORE")
+					|| isKeyword(tokens.at(ii - 1), "AFTER")
+					|| isKeyword(tokens.at(ii - 1), "OF"))) {
+				continue;
+			}
+			pos = ii + 1;
+			if (pos + 1 < tokens.size() && isKeyword(tokens.at(pos), "OR")) {
+				pos += 2;
+			}
+			if (pos < tokens.size() && isKeyword(tokens.at(pos), "FROM")) {
+				pos++;
+			}
+		} else if (isKeyword(tok, "TRUNCATE")) {
+			pos = ii + 1;
+			if (pos < tokens.size() && (isKeyword(tokens.at(pos), "FROM")
+					|| isKeyword(tokens.at(pos), "TABLE"))) {
+				pos++;
+			}
+		} else if (isKeyword(tok, "TABLE") && ii > 0) {
+			int jj = ii - 1;
+			if (isKeyword(tokens.at(jj), "TEMP") || isKeyword(tokens.at(jj), "TEMPORARY")) {
+				jj--;
+			}
+			if (jj >= 0 && (isKeyword(tokens.at(jj), "CREATE")
+					|| isKeyword(tokens.at(jj), "ALTER")
+					|| isKeyword(tokens.at(jj), "DROP"))) {
+				pos = ii + 1;
+			}
+		}
+
+		if (pos < 0) {
+			continue;
+		}
+		while (pos < tokens.size() && (isKeyword(tokens.at(pos), "IF")
+				|| isKeyword(tokens.at(pos), "NOT")
+				|| isKeyword(tokens.at(pos), "EXISTS")
+				|| isKeyword(tokens.at(pos), "ONLY"))) {
+			pos++;
+		}
+		QString name = readName(tokens, &pos);
+		if (!name.isEmpty() && !ret.contains(name)) {
+			ret << name;
+		}
+	}
+	return ret;
+}
+
+bool SqlStatement::isReadOnly(const QString &sql)
+{
+	return writtenTables(sql).isEmpty();
+}
+
+bool SqlStatement::isDdl(const QString &sql)
+{
+	return isDdl(tokenize(sql));
+}
+
+bool SqlStatement::isDdl(const QList<Token> &tokens)
+{
+	bool start = true;
+
+	for (int ii = 0; ii < tokens.size(); ii++) {
+		const Token &tok = tokens.at(ii);
+		if (start && (isKeyword(tok, "CREATE") || isKeyword(tok, "ALTER")
+				|| isKeyword(tok, "DROP") || isKeyword(tok, "RENAME"))) {
+			return true;
+		}
+		start = isSymbol(tok, ';');
+	}
+	return false;
+}
+
+QStringList SqlStatement::split(const QString &script)
+{
+	QList<Token> tokens = tokenize(script);
+	QStringList ret;
+	int first = -1;
+	bool trigger = false;
+	int depth = 0;
+
+	for (int ii = 0; ii < tokens.size(); ii++) {
+		const Token &tok = tokens.at(ii);
+		const bool separator = isSymbol(tok, ';');
+
+		if (first < 0) {
+			if (separator) {
+				continue;
+			}
+			first = ii;
+		}
+
+		//the body of a trigger contains statements terminated by semicolons
+		if (isKeyword(tok, "TRIGGER") && isKeyword(tokens.at(first), "CREATE")) {
+			trigger = true;
+		} else if (trigger && (isKeyword(tok, "BEGIN") || isKeyword(tok, "CASE"))) {
+			depth++;
+		} else if (trigger && depth > 0 && isKeyword(tok, "END")) {
+			depth--;
+		}
+
+		if (separator && depth == 0) {
+			const int begin = tokens.at(first).begin;
+			ret << script.mid(begin, tokens.at(ii - 1).end - begin);
+			first = -1;
+			trigger = false;
+		}
+	}
+
+	if (first >= 0) {
+		const int begin = tokens.at(first).begin;
+		ret << script.mid(begin, tokens.last().end - begin);
+	}
+	return ret;
+}
+
+QList<SqlStatement::Token> SqlStatement::tokenize(const QString &sql)
+{
+	QList<Token> ret;
+	const int len = sql.size();
+	int ii = 0;
+
+	while (ii < len) {
+		const QChar ch = sql.at(ii);
+
+		if (ch.isSpace()) {
+			ii++;
+		} else if (ch == '-' && ii + 1 < len && sql.at(ii + 1) == '-') {
+			//line comment
+			while (ii < len && sql.at(ii) != '\n') {
+				ii++;
+			}
+		} else if (ch == '/' && ii + 1 < len && sql.at(ii + 1) == '*') {
+			//block comment
+			int end = sql.indexOf("*/", ii + 2);
+			ii = (end < 0) ? len : end + 2;
+		} else if (ch == '\'') {
+			//string literal, '' is an escaped quote
+			int start = ii;
+			QString text;
+			ii++;
+			while (ii < len) {
+				if (sql.at(ii) == '\'') {
+					if (ii + 1 < len && sql.at(ii + 1) == '\'') {
+						text += '\'';
+						ii += 2;
+						continue;
+					}
+					break;
+				}
+				text += sql.at(ii);
+				ii++;
+			}
+			ii++;
+			Token tok = { text, false, false, true, start, qMin(ii, len) };
+			ret << tok;
+		} else if (ch == '"' || ch == '`' || ch == '[') {
+			//quoted identifier
+			const QChar close = (ch == '[') ? QChar(']') : ch;
+			int end = sql.indexOf(close, ii + 1);
+			if (end < 0) {
+				end = len;
+			}
+			Token tok = { sql.mid(ii + 1, end - ii - 1), true, true, false, ii, qMin(end + 1, len) };
+			ret << tok;
+			ii = end + 1;
+		} else if (ch == '$' && dollarTag(sql, ii) > 0) {
+			//dollar quoted string, $tag$ ... $tag$
+			const QString tag = sql.mid(ii, dollarTag(sql, ii));
+			int end = sql.indexOf(tag, ii + tag.size());
+			end = (end < 0) ? len : end + tag.size();
+			Token tok = { QString(), false, false, true, ii, end };
+			ret << tok;
+			ii = end;
+		} else if (ch.isLetterOrNumber() || ch == '_') {
+			int start = ii;
+			while (ii < len && (sql.at(ii).isLetterOrNumber() || sql.at(ii) == '_'
+								|| sql.at(ii) == '$')) {
+				ii++;
+			}
+			Token tok = { sql.mid(start, ii - start), true, false, false, start, ii };
+			ret << tok;
+		} else {
+			Token tok = { QString(ch), false, false, false, ii, ii + 1 };
+			ret << tok;
+			ii++;
+		}
+	}
+	return ret;
+}
+
+int SqlStatement::dollarTag(const QString &sql, int pos)
+{
+	//$$ or $name$, but not a parameter like $1
+	int ii = pos + 1;
+	while (ii < sql.size() && (sql.at(ii).isLetter() || sql.at(ii) == '_'
+			|| (ii > pos + 1 && sql.at(ii).isDigit()))) {
+		ii++;
+	}
+	return (ii < sql.size() && sql.at(ii) == '$') ? ii - pos + 1 : 0;
+}
+
+bool SqlStatement::isKeyword(const Token &token, const char *keyword)
+{
+	return token.isWord && !token.isQuoted
+		&& token.text.compare(QLatin1String(keyword), Qt::CaseInsensitive) == 0;
+}
+
+bool SqlStatement::isSymbol(const Token &token, char symbol)
+{
+	return !token.isWord && !token.isLiteral && token.text.size() == 1
+		&& token.text.at(0) == QLatin1Char(symbol);
+}
+
+QString SqlStatement::readName(const QList<Token> &tokens, int *pos)
+{
+	//SQLite accepts FROM 'table'
+	if (*pos < tokens.size() && tokens.at(*pos).isLiteral) {
+		(*pos)++;
+		return tokens.at(*pos - 1).text.toLower();
+	}
+
+	QString name;
+	while (*pos < tokens.size() && tokens.at(*pos).isWord) {
+		name = tokens.at(*pos).text;
+		(*pos)++;
+		if (*pos < tokens.size() && isSymbol(tokens.at(*pos), '.')) {
+			(*pos)++;
+			continue;
+		}
+		break;
+	}
+	return name.toLower();
+}
+
+}	//	namespace
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+
+namespace Database {
+
+/**
+ * @brief Lightweight analysis of sql statements.
+ *
+ * @details The statement is tokenized, string literals and comments are skipped and
+ * quoted identifiers are unquoted. It is not a full sql parser, but good enough to
+ * find the tables a statement reads or writes. Table names are returned in lower
+ * case without schema prefix. A string may contain several statements. Like SQLite,
+ * a single quoted string is accepted as table name.
+ */
+class SqlStatement
+{
+public:
+	/**
+	 * @brief Tables referenced by the statement (FROM, JOIN, INTO, UPDATE, TABLE).
+	 */
+	static QStringList tables(const QString &sql);
+
+	/**
+	 * @brief Tables modified by the statement: targets of INSERT, REPLACE, UPDATE,
+	 * DELETE, TRUNCATE and of CREATE, ALTER and DROP TABLE.
+	 */
+	static QStringList writtenTables(const QString &sql);
+
+	/**
+	 * @brief Same as writtenTables(), ddl is set to isDdl() of the statement. The
+	 * statement is tokenized only once.
+	 */
+	static QStringList writtenTables(const QString &sql, bool *ddl);
+
+	/**
+	 * @brief Returns \c true if the statement does not modify any table.
+	 */
+	static bool isReadOnly(const QString &sql);
+
+	/**
+	 * @brief Returns \c true if the statement changes the schema (CREATE, ALTER, DROP
+	 * or RENAME).
+	 */
+	static bool isDdl(const QString &sql);
+
+	/**
+	 * @brief Splits a script into its statements at semicolons.
+	 * @details Semicolons in string literals, quoted identifiers, comments, dollar
+	 * quoted bodies ($$ ... $$) and BEGIN ... END blocks of CREATE TRIGGER are not
+	 * separators. Comments between statements and empty statements are dropped,
+	 * the statements are returned without the terminating semicolon.
+	 */
+	static QStringList split(const QString &script);
+
+private:
+	typedef struct Token {
+		QString text;
+		/** identifier or keyword, otherwise punctuation */
+		bool isWord;
+		/** quoted identifier, never a keyword */
+		bool isQuoted;
+		/** string literal, text is its unescaped content */
+		bool isLiteral;
+		/** position of the token in the statement, end is exclusive */
+		int begin;
+		int end;
+	} Token;
+
+	static QList<Token> tokenize(const QString &sql);
+	/* length of the dollar quote tag at pos, 0 if there is none */
+	static int dollarTag(const QString &sql, int pos);
+	static QStringList writtenTables(const QList<Token> &tokens);
+	static bool isDdl(const QList<Token> &tokens);
+	static bool isKeyword(const Token &token, const char *keyword);
+	/* punctuation like ";" or "," */
+	static bool isSymbol(const Token &token, char symbol);
+	/* reads a possibly qualified name or a string literal at pos, returns the last
+	 * part */
+	static QString readName(const QList<Token> &tokens, int *pos);
+};
+
+}	//	namespace
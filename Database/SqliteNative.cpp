@@ -0,0 +1,253 @@
+#include "SqliteNative.h"
+#include "ResultBuilder.h"
+
+#include <QSqlDriver>
+#include <QSqlField>
+#include <QSqlRecord>
+#include <QVector>
+
+#ifdef ASYNCSQL_SQLITE_NATIVE
+#include <sqlite3.h>
+#endif
+
+namespace Database {
+
+#ifdef ASYNCSQL_SQLITE_NATIVE
+
+namespace {
+
+/* column type from the declared type, like the QSQLITE driver */
+QVariant::Type declaredType(const char *decl)
+{
+	const QString type = QString::fromLatin1(decl).toLower();
+	if (type.contains("int")) {
+		return QVariant::LongLong;
+	}
+	if (type.contains("real") || type.contains("floa") || type.contains("doub")) {
+		return QVariant::Double;
+	}
+	if (type.contains("blob")) {
+		return QVariant::ByteArray;
+	}
+	return QVariant::String;
+}
+
+}
+
+SqliteNative::SqliteNative(const QSqlDatabase &db)
+	: _handle(nullptr)
+	, _stmt(nullptr)
+	, _rc(SQLITE_OK)
+{
+	if (db.driverName() != "QSQLITE" || !db.isOpen()) {
+		return;
+	}
+	QVariant handle = db.driver()->handle();
+	if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0) {
+		_handle = *static_cast<sqlite3 * const *>(handle.constData());
+	}
+}
+
+SqliteNative::~SqliteNative()
+{
+	if (_stmt != nullptr) {
+		sqlite3_finalize(_stmt);
+	}
+}
+
+bool SqliteNative::isValid() const
+{
+	return _handle != nullptr;
+}
+
+bool SqliteNative::prepare(const QString &query, const QMap<QString, QVariant> &boundValues)
+{
+	if (_stmt != nullptr) {
+		sqlite3_finalize(_stmt);
+		_stmt = nullptr;
+	}
+
+	_rc = sqlite3_prepare16_v2(_handle, query.constData(), (query.size() + 1) * sizeof(QChar),
+							   &_stmt, nullptr);
+	if (_rc != SQLITE_OK) {
+		return false;
+	}
+
+	bind(boundValues);
+	return _rc == SQLITE_OK;
+}
+
+bool SqliteNative::exec()
+{
+	if (_stmt == nullptr || _rc != SQLITE_OK) {
+		return false;
+	}
+	_rc = sqlite3_step(_stmt);
+	return _rc == SQLITE_ROW || _rc == SQLITE_DONE;
+}
+
+void SqliteNative::fetch(ResultBuilder &builder)
+{
+	const int cols = (_stmt != nullptr) ? sqlite3_column_count(_stmt) : 0;
+
+	QSqlRecord record;
+	for (int ii = 0; ii < cols; ii++) {
+		QString name = QString::fromUtf16(
+			static_cast<const ushort*>(sqlite3_column_name16(_stmt, ii)));
+		const char *decl = sqlite3_column_decltype(_stmt, ii);
+		record.append(QSqlField(name, declaredType(decl != nullptr ? decl : "")));
+	}
+	builder.setRecord(record);
+
+	while (_rc == SQLITE_ROW) {
+		QVector<QVariant> currow(cols);
+
+		for (int ii = 0; ii < cols; ii++) {
+			switch (sqlite3_column_type(_stmt, ii)) {
+			case SQLITE_INTEGER:
+				currow[ii] = qlonglong(sqlite3_column_int64(_stmt, ii));
+				break;
+			case SQLITE_FLOAT:
+				currow[ii] = sqlite3_column_double(_stmt, ii);
+				break;
+			case SQLITE_BLOB:
+				currow[ii] = QByteArray(
+					static_cast<const char*>(sqlite3_column_blob(_stmt, ii)),
+					sqlite3_column_bytes(_stmt, ii));
+				break;
+			case SQLITE_NULL:
+				currow[ii] = QVariant();
+				break;
+			default:
+				currow[ii] = QString(
+					reinterpret_cast<const QChar*>(sqlite3_column_text16(_stmt, ii)),
+					sqlite3_column_bytes16(_stmt, ii) / int(sizeof(QChar)));
+				break;
+			}
+		}
+		builder.appendFetchedRow(currow);
+		_rc = sqlite3_step(_stmt);
+	}
+
+	if (_rc != SQLITE_DONE) {
+		builder.setError(lastError());
+	}
+}
+
+bool SqliteNative::isCompiled()
+{
+	return true;
+}
+
+void SqliteNative::bind(const QMap<QString, QVariant> &boundValues)
+{
+	QMapIterator<QString, QVariant> i(boundValues);
+	while (i.hasNext()) {
+		i.next();
+		//QSqlQuery accepts names without prefix, sqlite expects ":name"
+		QString name = i.key();
+		if (!name.startsWith(':') && !name.startsWith('@') && !name.startsWith('$')) {
+			name.prepend(':');
+		}
+		int idx = sqlite3_bind_parameter_index(_stmt, name.toUtf8().constData());
+		if (idx == 0) {
+			continue;
+		}
+
+		const QVariant &val = i.value();
+		if (val.isNull()) {
+			_rc = sqlite3_bind_null(_stmt, idx);
+		} else {
+			switch (val.userType()) {
+			case QMetaType::Bool:
+			case QMetaType::Int:
+			case QMetaType::UInt:
+			case QMetaType::LongLong:
+			case QMetaType::ULongLong:
+				_rc = sqlite3_bind_int64(_stmt, idx, val.toLongLong());
+				break;
+			case QMetaType::Double:
+				_rc = sqlite3_bind_double(_stmt, idx, val.toDouble());
+				break;
+			case QMetaType::QByteArray: {
+				QByteArray data = val.toByteArray();
+				_rc = sqlite3_bind_blob(_stmt, idx, data.constData(), data.size(),
+										SQLITE_TRANSIENT);
+				break;
+			}
+			default: {
+				QString str = val.toString();
+				_rc = sqlite3_bind_text16(_stmt, idx, str.constData(),
+										  str.size() * int(sizeof(QChar)), SQLITE_TRANSIENT);
+				break;
+			}
+			}
+		}
+		if (_rc != SQLITE_OK) {
+			return;
+		}
+	}
+}
+
+QSqlError SqliteNative::lastError() const
+{
+	//native error code like the QSQLITE driver, see RetryPolicy::classify()
+	return QSqlError(QString(), QString::fromUtf16(
+						 static_cast<const ushort*>(sqlite3_errmsg16(_handle))),
+					 QSqlError::StatementError, QString::number(_rc));
+}
+
+#else
+
+SqliteNative::SqliteNative(const QSqlDatabase &db)
+	: _handle(nullptr)
+	, _stmt(nullptr)
+	, _rc(0)
+{
+	Q_UNUSED(db);
+}
+
+SqliteNative::~SqliteNative()
+{
+}
+
+bool SqliteNative::isValid() const
+{
+	return false;
+}
+
+bool SqliteNative::prepare(const QString &query, const QMap<QString, QVariant> &boundValues)
+{
+	Q_UNUSED(query);
+	Q_UNUSED(boundValues);
+	return false;
+}
+
+bool SqliteNative::exec()
+{
+	return false;
+}
+
+void SqliteNative::fetch(ResultBuilder &builder)
+{
+	Q_UNUSED(builder);
+}
+
+bool SqliteNative::isCompiled()
+{
+	return false;
+}
+
+void SqliteNative::bind(const QMap<QString, QVariant> &boundValues)
+{
+	Q_UNUSED(boundValues);
+}
+
+QSqlError SqliteNative::lastError() const
+{
+	return QSqlError();
+}
+
+#endif
+
+}	//	namespace
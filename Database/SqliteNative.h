@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QMap>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QString>
+#include <QVariant>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace Database {
+
+// class forward decl's
+class ResultBuilder;
+
+/**
+ * @brief Executes a query directly on the sqlite3 handle of a QSQLITE connection.
+ *
+ * @details Rows are stepped with its own statement handle and the values are read
+ * with the sqlite3_column_* functions straight into a ResultBuilder, without the
+ * QSqlQuery and QVariant conversions of the driver. Values have the types the QSQLITE
+ * driver returns: qlonglong, double, QString, QByteArray or a null QVariant.
+ *
+ * The fast path is compiled in with DEFINES += ASYNCSQL_SQLITE_NATIVE (CONFIG +=
+ * asyncsql_sqlite_native in Database.pri), the application links libsqlite3 then. The
+ * QSQLITE plugin has to use the same SQLite library (Qt configured with
+ * -system-sqlite), otherwise the handle must not be passed to it. Without the define
+ * isValid() is always \c false and queries run through QSqlQuery.
+ */
+class SqliteNative
+{
+public:
+	/**
+	 * @brief Takes the sqlite3 handle of db, if db is an open QSQLITE connection.
+	 */
+	explicit SqliteNative(const QSqlDatabase &db);
+	virtual ~SqliteNative();
+
+	/**
+	 * @brief Returns \c true if the fast path is compiled in and db provided a handle.
+	 */
+	bool isValid() const;
+
+	/**
+	 * @brief Prepares the statement and binds the values.
+	 * @returns \c false on error, the error is reported by fetch().
+	 */
+	bool prepare(const QString &query, const QMap<QString, QVariant> &boundValues);
+
+	/**
+	 * @brief Executes the prepared statement, it steps to the first row.
+	 * @returns \c false on error, the error is reported by fetch().
+	 */
+	bool exec();
+
+	/**
+	 * @brief Sets record and error of the executed statement and appends all rows.
+	 */
+	void fetch(ResultBuilder &builder);
+
+	/**
+	 * @brief Returns \c true if the QSQLITE native path is compiled in.
+	 */
+	static bool isCompiled();
+
+private:
+	void bind(const QMap<QString, QVariant> &boundValues);
+	QSqlError lastError() const;
+
+private:
+	sqlite3 *_handle;
+	sqlite3_stmt *_stmt;
+	int _rc;
+};
+
+}	//	namespace
@@ -0,0 +1,83 @@
+#include "TaskScheduler.h"
+
+namespace Database {
+
+TaskScheduler::TaskScheduler()
+	: QThread()
+	, _quit(false)
+{
+	_clock.start();
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	stop();
+	wait();
+}
+
+void TaskScheduler::schedule(qint64 delayMs, const std::function<void()> &fn,
+							 const std::function<void()> &cancel)
+{
+	QMutexLocker locker(&_mutex);
+	if (_quit) {
+		locker.unlock();
+		if (cancel) {
+			cancel();
+		}
+		return;
+	}
+	Entry entry;
+	entry.fn = fn;
+	entry.cancel = cancel;
+	_tasks.insert(_clock.elapsed() + qMax<qint64>(0, delayMs), entry);
+	_condition.wakeOne();
+}
+
+int TaskScheduler::pending() const
+{
+	QMutexLocker locker(&_mutex);
+	return _tasks.size();
+}
+
+void TaskScheduler::stop()
+{
+	QList<Entry> canceled;
+	{
+		QMutexLocker locker(&_mutex);
+		_quit = true;
+		canceled = _tasks.values();
+		_tasks.clear();
+		_condition.wakeOne();
+	}
+
+	//called outside of the locked area, they may schedule again
+	for (int ii = 0; ii < canceled.size(); ii++) {
+		if (canceled.at(ii).cancel) {
+			canceled.at(ii).cancel();
+		}
+	}
+}
+
+void TaskScheduler::run()
+{
+	QMutexLocker locker(&_mutex);
+	while (!_quit) {
+		if (_tasks.isEmpty()) {
+			_condition.wait(&_mutex);
+			continue;
+		}
+
+		qint64 wait = _tasks.firstKey() - _clock.elapsed();
+		if (wait > 0) {
+			_condition.wait(&_mutex, ulong(wait));
+			continue;
+		}
+
+		std::function<void()> fn = _tasks.take(_tasks.firstKey()).fn;
+		locker.unlock();
+		fn();
+		locker.relock();
+	}
+}
+
+}	//	namespace
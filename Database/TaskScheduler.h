@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMultiMap>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <functional>
+
+namespace Database {
+
+/**
+ * @brief Thread which runs functions after a delay.
+ *
+ * @details Used to schedule retries of queries (see RetryPolicy) without sleeping on
+ * a thread of the pool. The functions should only dispatch work, e.g. start a task
+ * in the thread pool, since they run one after another on the scheduler thread.
+ *
+ * The scheduler is maintained by the ConnectionManager (see
+ * ConnectionManager::scheduler()).
+ */
+class TaskScheduler : public QThread
+{
+	Q_OBJECT
+
+public:
+	TaskScheduler();
+	virtual ~TaskScheduler();
+
+	/**
+	 * @brief Runs fn on the scheduler thread after delayMs milliseconds.
+	 * @details If the scheduler is stopped before, cancel is called instead, e.g. to
+	 * finish the work waiting for fn. cancel is called in the thread calling stop(),
+	 * or right away if the scheduler is stopped already.
+	 */
+	void schedule(qint64 delayMs, const std::function<void()> &fn,
+				  const std::function<void()> &cancel = std::function<void()>());
+
+	/**
+	 * @brief Number of functions waiting for their time.
+	 */
+	int pending() const;
+
+	/**
+	 * @brief Stops the scheduler, the cancel functions of pending functions are called.
+	 * Use wait() to join.
+	 */
+	void stop();
+
+protected:
+	void run() override;
+
+private:
+	typedef struct Entry {
+		std::function<void()> fn;
+		std::function<void()> cancel;
+	} Entry;
+
+	mutable QMutex _mutex;
+	QWaitCondition _condition;
+	QElapsedTimer _clock;
+	/* functions by due time on _clock */
+	QMultiMap<qint64, Entry> _tasks;
+	bool _quit;
+};
+
+}	//	namespace
@@ -0,0 +1,170 @@
+#include "TaskTrace.h"
+
+#include <QMutex>
+#include <QSaveFile>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
+
+namespace Database {
+
+namespace {
+
+/* serializes enabling, resizing and clearing, never taken when recording */
+QMutex traceMutex;
+
+typedef struct SpanCopy {
+	quint64 seq;
+	const char *name;
+	quint64 id;
+	quintptr tid;
+	qint64 start;
+	qint64 end;
+} SpanCopy;
+
+}
+
+QAtomicInt TaskTrace::_enabled(0);
+QAtomicInteger<quint64> TaskTrace::_head(0);
+QAtomicInteger<quint64> TaskTrace::_ids(0);
+TaskTrace::Slot *TaskTrace::_slots = nullptr;
+int TaskTrace::_capacity = 65536;
+QElapsedTimer TaskTrace::_clock;
+
+void TaskTrace::setEnabled(bool enable)
+{
+	QMutexLocker locker(&traceMutex);
+	if (enable && _slots == nullptr) {
+		_slots = new Slot[_capacity];
+		for (int ii = 0; ii < _capacity; ii++) {
+			_slots[ii].seq.store(0);
+		}
+		_head.store(0);
+		if (!_clock.isValid()) {
+			_clock.start();
+		}
+	}
+	_enabled.store(enable ? 1 : 0);
+}
+
+void TaskTrace::setCapacity(int spans)
+{
+	QMutexLocker locker(&traceMutex);
+	//recording threads may still hold a slot, the buffer is never freed
+	if (_slots != nullptr || spans <= 0) {
+		return;
+	}
+	_capacity = spans;
+}
+
+int TaskTrace::capacity()
+{
+	QMutexLocker locker(&traceMutex);
+	return _capacity;
+}
+
+quint64 TaskTrace::nextId()
+{
+	return _ids.fetchAndAddRelaxed(1) + 1;
+}
+
+qint64 TaskTrace::now()
+{
+	return _clock.nsecsElapsed() / 1000;
+}
+
+void TaskTrace::record(const char *name, quint64 id, qint64 startUs, qint64 endUs)
+{
+	if (_enabled.load() == 0) {
+		return;
+	}
+
+	//claim a slot, mark it as being written while the fields are set
+	quint64 seq = _head.fetchAndAddRelaxed(1);
+	Slot &slot = _slots[seq % quint64(_capacity)];
+	slot.seq.store(0);
+	//keeps the field stores below from becoming visible before the 0
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.name.store(name);
+	slot.id.store(id);
+	slot.tid.store(quintptr(QThread::currentThreadId()));
+	slot.start.store(startUs);
+	slot.end.store(endUs);
+	slot.seq.storeRelease(seq + 1);
+}
+
+QByteArray TaskTrace::toChromeJson()
+{
+	QVector<SpanCopy> spans;
+	{
+		QMutexLocker locker(&traceMutex);
+		if (_slots != nullptr) {
+			spans.reserve(_capacity);
+			for (int ii = 0; ii < _capacity; ii++) {
+				const Slot &slot = _slots[ii];
+				SpanCopy span;
+				span.seq = slot.seq.loadAcquire();
+				if (span.seq == 0) {
+					continue;
+				}
+				span.name = slot.name.load();
+				span.id = slot.id.load();
+				span.tid = slot.tid.load();
+				span.start = slot.start.load();
+				span.end = slot.end.load();
+				//keeps the field loads above from moving after the re-check,
+				//skip slots overwritten while copying
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (slot.seq.load() == span.seq) {
+					spans.append(span);
+				}
+			}
+		}
+	}
+
+	std::sort(spans.begin(), spans.end(), [](const SpanCopy &a, const SpanCopy &b) {
+		return a.seq < b.seq;
+	});
+
+	QByteArray json("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (int ii = 0; ii < spans.size(); ii++) {
+		const SpanCopy &span = spans.at(ii);
+		if (ii > 0) {
+			json.append(",\n");
+		}
+		json.append("{\"name\":\"").append(span.name)
+			.append("\",\"cat\":\"AsyncQuery\",\"ph\":\"X\",\"pid\":1,\"tid\":")
+			.append(QByteArray::number(qulonglong(span.tid)))
+			.append(",\"ts\":").append(QByteArray::number(span.start))
+			.append(",\"dur\":").append(QByteArray::number(qMax<qint64>(0, span.end - span.start)))
+			.append(",\"args\":{\"id\":").append(QByteArray::number(span.id))
+			.append("}}");
+	}
+	json.append("]}\n");
+	return json;
+}
+
+bool TaskTrace::dump(const QString &fileName)
+{
+	QSaveFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly)) {
+		return false;
+	}
+	file.write(toChromeJson());
+	return file.commit();
+}
+
+void TaskTrace::clear()
+{
+	QMutexLocker locker(&traceMutex);
+	if (_slots == nullptr) {
+		return;
+	}
+	for (int ii = 0; ii < _capacity; ii++) {
+		_slots[ii].seq.store(0);
+	}
+}
+
+}	//	namespace
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QString>
+
+namespace Database {
+
+/**
+ * @brief Optional timeline tracing of the task lifecycle of AsyncQuery.
+ *
+ * @details If enabled, AsyncQuery records spans for the phases of each query: queued
+ * (enqueue until the task starts the query), delay, connect, prepare, exec, fetch,
+ * callback and delivery (until the result reaches the thread of the AsyncQuery).
+ * Spans are written to a fixed size, lock-free ring buffer, older spans are
+ * overwritten. When disabled the cost is one atomic load per span.
+ *
+ * The buffer can be dumped in the Chrome trace event format and viewed with
+ * chrome://tracing or https://ui.perfetto.dev. Spans of one query share the
+ * argument "id".
+ *
+ * \code{.cpp}
+ * Database::TaskTrace::setEnabled(true);
+ * ...
+ * Database::TaskTrace::dump("trace.json");
+ * \endcode
+ */
+class TaskTrace
+{
+public:
+	/**
+	 * @brief RAII helper, records a span from construction to destruction.
+	 */
+	class Span
+	{
+	public:
+		Span(const char *name, quint64 id)
+			: _name(name), _id(id), _start(isEnabled() ? now() : -1) {}
+		~Span() { if (_start >= 0) { record(_name, _id, _start, now()); } }
+
+	private:
+		const char *_name;
+		quint64 _id;
+		qint64 _start;
+	};
+
+	/**
+	 * @brief Enables or disables tracing. Default is disabled.
+	 */
+	static void setEnabled(bool enable);
+	static bool isEnabled() { return _enabled.load() != 0; }
+
+	/**
+	 * @brief Set the number of spans kept in the ring buffer, default is 65536.
+	 * @note Only applied before tracing is enabled the first time.
+	 */
+	static void setCapacity(int spans);
+	static int capacity();
+
+	/**
+	 * @brief Returns a new id for the spans of a query.
+	 */
+	static quint64 nextId();
+
+	/**
+	 * @brief Microseconds on the clock of the trace.
+	 */
+	static qint64 now();
+
+	/**
+	 * @brief Records a span. name must be a string literal.
+	 */
+	static void record(const char *name, quint64 id, qint64 startUs, qint64 endUs);
+
+	/**
+	 * @brief Returns the recorded spans as Chrome trace event JSON.
+	 */
+	static QByteArray toChromeJson();
+
+	/**
+	 * @brief Writes toChromeJson() to a file.
+	 */
+	static bool dump(const QString &fileName);
+
+	/**
+	 * @brief Removes all recorded spans.
+	 */
+	static void clear();
+
+private:
+	typedef struct Slot {
+		/* 0 while written, otherwise the sequence number + 1 of the span */
+		QAtomicInteger<quint64> seq;
+		/* accessed relaxed, ordered by the fences around seq */
+		QAtomicPointer<const char> name;
+		QAtomicInteger<quint64> id;
+		QAtomicInteger<quintptr> tid;
+		QAtomicInteger<qint64> start;
+		QAtomicInteger<qint64> end;
+	} Slot;
+
+	static QAtomicInt _enabled;
+	static QAtomicInteger<quint64> _head;
+	static QAtomicInteger<quint64> _ids;
+	static Slot *_slots;
+	static int _capacity;
+	static QElapsedTimer _clock;
+};
+
+}	//	namespace
@@ -15,17 +15,11 @@ TEMPLATE = app
 
 
 SOURCES += main.cpp\
-	mainwindow.cpp \
-	Database/AsyncQuery.cpp \
-	Database/AsyncQueryResult.cpp \
-	Database/ConnectionManager.cpp \
-	Database/AsynqQueryModel.cpp
-
-HEADERS += mainwindow.h \
-	Database/AsyncQuery.h \
-	Database/AsyncQueryResult.h \
-	Database/ConnectionManager.h \
-	Database/AsynqQueryModel.h
+	mainwindow.cpp
+
+HEADERS += mainwindow.h
+
+include(Database/Database.pri)
 
 FORMS += mainwindow.ui
 
@@ -1,11 +1,13 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
+#include <QHeaderView>
 #include <QMovie>
 
 #include "Database/ConnectionManager.h"
 #include "Database/AsyncQuery.h"
 #include "Database/AsynqQueryModel.h"
+#include "Database/SchemaCatalog.h"
 #include "QComboBox"
 
 
@@ -23,20 +25,16 @@ MainWindow::MainWindow(QWidget *parent)
 	connect (ui->cbTables, SIGNAL(currentIndexChanged(QString)),
 			 this, SLOT(onComboBoxChanged(QString)));
 
-	//fill combobox with table Strings use lambda expression
-	Database::AsyncQuery::startExecOnce(
-				"SELECT name FROM sqlite_master WHERE type='table'",
-				[=](const Database::AsyncQueryResult& res) {
-		for (int i = 0; i < res.count(); i++) {
-			ui->cbTables->addItem(res.value(i, "name").toString());
-		}
-		if (res.count() > 0) {
-			ui->cbTables->setCurrentIndex(0);
-		}
-	});
-
 	_tableModel = new Database::AsyncQueryModel(this);
 	ui->tvTables->setModel(_tableModel);
+	_tableModel->setAutoRefresh(true);
+
+	//fill combobox with the tables of the schema catalog, loaded in the background
+	Database::SchemaCatalog *catalog = Database::ConnectionManager::instance()->schemaCatalog();
+	connect (catalog, SIGNAL(loaded()), this, SLOT(onSchemaLoaded()));
+	if (catalog->isLoaded()) {
+		onSchemaLoaded();
+	}
 
 	connect (_tableModel->asyncQuery(), SIGNAL(busyChanged(bool)),
 			 this, SLOT(onBusyChanged(bool)));
@@ -54,6 +52,9 @@ MainWindow::MainWindow(QWidget *parent)
 
 	_queryModel = new Database::AsyncQueryModel(this);
 	ui->tvQuery->setModel(_queryModel);
+	//keep the order of the statement until a header is clicked
+	ui->tvQuery->horizontalHeader()->setSortIndicator(-1, Qt::AscendingOrder);
+	ui->tvQuery->setSortingEnabled(true);
 
 	connect (_queryModel->asyncQuery(), SIGNAL(busyChanged(bool)),
 			 this, SLOT(onBusyChanged(bool)));
@@ -106,7 +107,32 @@ void MainWindow::onBusyChanged(bool busy)
 
 void MainWindow::onComboBoxChanged(const QString &index)
 {
-	_tableModel->startExec("SELECT * FROM '" + index + "'");
+	//quoted identifier, so the model finds the table for the auto refresh
+	QString table = index;
+	_tableModel->startExec("SELECT * FROM \"" + table.replace('"', "\"\"") + "\"");
+}
+
+void MainWindow::onSchemaLoaded()
+{
+	//reloaded after schema changes, keep the selected table
+	QStringList tables = Database::ConnectionManager::instance()->schemaCatalog()->tables();
+	QStringList shown;
+	for (int ii = 0; ii < ui->cbTables->count(); ii++) {
+		shown << ui->cbTables->itemText(ii);
+	}
+	if (tables == shown) {
+		return;
+	}
+
+	QString current = ui->cbTables->currentText();
+	ui->cbTables->blockSignals(true);
+	ui->cbTables->clear();
+	ui->cbTables->addItems(tables);
+	ui->cbTables->setCurrentIndex(qMax(0, tables.indexOf(current)));
+	ui->cbTables->blockSignals(false);
+	if (!tables.isEmpty() && ui->cbTables->currentText() != current) {
+		onComboBoxChanged(ui->cbTables->currentText());
+	}
 }
 
 void MainWindow::onClearClicked(bool clicked)
@@ -25,6 +25,7 @@ public slots:
 	void onBusyChanged(bool busy);
 
 	void onComboBoxChanged (const QString &index);
+	void onSchemaLoaded();
 	void onExec4Queries(bool clicked);
 	void onClearClicked(bool clicked);
 	void onExec4QueriesDone(const Database::AsyncQueryResult& result);
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Contention benchmark of concurrent producers on one AsyncQuery
+#
+#-------------------------------------------------
+
+QT += core sql
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = AsyncSqlBench
+TEMPLATE = app
+
+SOURCES += main.cpp
+
+include(../../Database/Database.pri)
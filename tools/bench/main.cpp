@@ -0,0 +1,172 @@
+/*
+ * Measures the submission path of AsyncQuery under contention: several producer
+ * threads start queries on one shared object, in Mode_Parallel and in Mode_Fifo.
+ *
+ * For each mode it reports the time the producers spent in startExec(), the
+ * submissions per second, the time until all queries were done and the
+ * throughput. Only the public API is used, so the tool builds against older
+ * versions of the library for before/after comparisons.
+ */
+
+#include <QAtomicInt>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <cstdio>
+
+#include "Database/AsyncQuery.h"
+#include "Database/ConnectionManager.h"
+
+namespace {
+
+/* starts count queries on the shared object as fast as possible */
+class ProducerThread : public QThread
+{
+public:
+	ProducerThread(Database::AsyncQuery *query, const QString &sql, int count)
+		: _query(query)
+		, _sql(sql)
+		, _count(count)
+		, _rejected(0)
+		, _submitNs(0)
+	{
+	}
+
+	int rejected() const
+	{
+		return _rejected;
+	}
+
+	qint64 submitNs() const
+	{
+		return _submitNs;
+	}
+
+protected:
+	void run() override
+	{
+		QElapsedTimer timer;
+		timer.start();
+		for (int ii = 0; ii < _count; ii++) {
+			if (!_query->startExec(_sql)) {
+				_rejected++;
+			}
+		}
+		_submitNs = timer.nsecsElapsed();
+	}
+
+private:
+	Database::AsyncQuery *_query;
+	QString _sql;
+	int _count;
+	int _rejected;
+	qint64 _submitNs;
+};
+
+void runMode(const char *name, Database::AsyncQuery::Mode mode, const QString &sql,
+			 int producers, int count)
+{
+	Database::AsyncQuery query;
+	query.setMode(mode);
+
+	//counted in the pool threads, no event loop runs here to deliver queued signals
+	QAtomicInt done(0);
+	QObject::connect(&query, &Database::AsyncQuery::execDone, &query,
+					 [&done](const Database::AsyncQueryResult &) {
+		done.ref();
+	}, Qt::DirectConnection);
+
+	QVector<ProducerThread*> threads;
+	for (int ii = 0; ii < producers; ii++) {
+		threads << new ProducerThread(&query, sql, count);
+	}
+
+	QElapsedTimer clock;
+	clock.start();
+	for (int ii = 0; ii < threads.size(); ii++) {
+		threads.at(ii)->start();
+	}
+	qint64 submitNs = 0;
+	int rejected = 0;
+	for (int ii = 0; ii < threads.size(); ii++) {
+		threads.at(ii)->wait();
+		submitNs = qMax(submitNs, threads.at(ii)->submitNs());
+		rejected += threads.at(ii)->rejected();
+	}
+	qint64 submittedMs = clock.elapsed();
+
+	//execDone() is emitted after the task count dropped, wait for the deliveries
+	const int total = producers * count;
+	query.waitDone();
+	while (done.load() < total - rejected) {
+		QThread::yieldCurrentThread();
+	}
+	qint64 doneMs = clock.elapsed();
+	//the tasks leave their callbacks before the object is destroyed
+	QThreadPool::globalInstance()->waitForDone();
+	qDeleteAll(threads);
+
+	double submitSeconds = qMax<qint64>(1, submitNs) / 1e9;
+	double doneSeconds = qMax<qint64>(1, doneMs) / 1000.0;
+	printf("%s\n", name);
+	printf("  queries:     %d (%d producers)\n", total, producers);
+	printf("  rejected:    %d\n", rejected);
+	printf("  submitted:   %lld ms\n", submittedMs);
+	printf("  submissions: %.0f /s\n", total / submitSeconds);
+	printf("  done:        %lld ms\n", doneMs);
+	printf("  throughput:  %.0f queries/s\n", total / doneSeconds);
+	printf("  delivered:   %d\n", done.load());
+	fflush(stdout);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("AsyncSqlBench");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(
+		"Starts queries from several threads on one AsyncQuery.");
+	parser.addHelpOption();
+	QCommandLineOption dbOption("db", "SQLite database file.", "file", "data/Northwind.sl3");
+	QCommandLineOption driverOption("driver", "Qt sql driver.", "name", "QSQLITE");
+	QCommandLineOption producersOption("producers", "Number of producer threads.",
+		"n", "8");
+	QCommandLineOption countOption("count", "Queries started by each producer.",
+		"n", "10000");
+	QCommandLineOption sqlOption("sql", "Statement to execute.", "sql", "SELECT 1");
+	QCommandLineOption concurrencyOption("concurrency",
+		"Number of threads of the pool, 0 keeps the default.", "n", "0");
+	parser.addOption(dbOption);
+	parser.addOption(driverOption);
+	parser.addOption(producersOption);
+	parser.addOption(countOption);
+	parser.addOption(sqlOption);
+	parser.addOption(concurrencyOption);
+	parser.process(app);
+
+	const int concurrency = parser.value(concurrencyOption).toInt();
+	if (concurrency > 0) {
+		QThreadPool::globalInstance()->setMaxThreadCount(concurrency);
+	}
+
+	Database::ConnectionManager *mgr = Database::ConnectionManager::createInstance();
+	mgr->setType(parser.value(driverOption));
+	mgr->setDatabaseName(parser.value(dbOption));
+
+	const int producers = qMax(1, parser.value(producersOption).toInt());
+	const int count = qMax(1, parser.value(countOption).toInt());
+	const QString sql = parser.value(sqlOption);
+
+	runMode("Mode_Parallel", Database::AsyncQuery::Mode_Parallel, sql, producers, count);
+	runMode("Mode_Fifo", Database::AsyncQuery::Mode_Fifo, sql, producers, count);
+
+	Database::ConnectionManager::destroyInstance();
+	return 0;
+}
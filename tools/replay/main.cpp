@@ -0,0 +1,345 @@
+/*
+ * Replays a query log through AsyncQuery and reports throughput, latency
+ * percentiles and errors.
+ *
+ * The log has one JSON object per line, empty lines and lines starting with '#'
+ * are ignored:
+ *
+ *   {"t": 0, "sql": "SELECT * FROM Orders WHERE OrderID = :id", "bind": {":id": 10248}}
+ *   {"t": 5, "sql": "UPDATE Orders SET Freight = 1 WHERE OrderID = 10248", "mode": "fifo"}
+ *   {"t": 9, "sql": "SELECT * FROM Customers", "mode": "keyed", "key": "cust"}
+ *
+ * t      submission time in ms relative to the first entry
+ * sql    the statement, required
+ * bind   values bound to named placeholders, the statement is prepared then
+ * mode   "parallel" (default), "fifo" (serialized per stream) or "keyed"
+ *        (serialized per key, all keys share one Mode_KeyedSerial object)
+ * stream name of the fifo stream, default ""
+ * key    key of keyed entries
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QQueue>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+
+#include "Database/AsyncQuery.h"
+#include "Database/ConnectionManager.h"
+
+namespace {
+
+typedef struct LogEntry {
+	qint64 t;
+	QString sql;
+	QVariantMap bind;
+	QString mode;
+	QString stream;
+	QString key;
+} LogEntry;
+
+typedef struct Stats {
+	QVector<qint64> latencyUs;
+	int errors;
+	int retries;
+	QMap<QString, int> errorTexts;
+} Stats;
+
+bool readLog(const QString &fileName, QVector<LogEntry> *entries, QString *error)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly)) {
+		*error = file.errorString();
+		return false;
+	}
+
+	int lineNo = 0;
+	while (!file.atEnd()) {
+		QByteArray line = file.readLine().trimmed();
+		lineNo++;
+		if (line.isEmpty() || line.startsWith('#')) {
+			continue;
+		}
+
+		QJsonParseError parseError;
+		QJsonObject obj = QJsonDocument::fromJson(line, &parseError).object();
+		if (parseError.error != QJsonParseError::NoError || !obj.contains("sql")) {
+			*error = QString("line %1: invalid entry").arg(lineNo);
+			return false;
+		}
+
+		LogEntry entry;
+		entry.t = qint64(obj.value("t").toDouble());
+		entry.sql = obj.value("sql").toString();
+		entry.bind = obj.value("bind").toObject().toVariantMap();
+		entry.mode = obj.value("mode").toString("parallel");
+		if (entry.mode == "keyed") {
+			//not null, startExecKeyed() runs null keys in parallel
+			entry.key = obj.value("key").toString("");
+		} else if (entry.mode == "fifo") {
+			entry.stream = "fifo:" + obj.value("stream").toString();
+		} else if (entry.mode == "parallel") {
+			entry.stream = QString();
+		} else {
+			*error = QString("line %1: unknown mode %2").arg(lineNo).arg(entry.mode);
+			return false;
+		}
+		entries->append(entry);
+	}
+	return true;
+}
+
+qint64 percentile(const QVector<qint64> &sorted, double p)
+{
+	if (sorted.isEmpty()) {
+		return 0;
+	}
+	int idx = qBound(0, int(p * (sorted.size() - 1) + 0.5), sorted.size() - 1);
+	return sorted.at(idx);
+}
+
+void report(const Stats &stats, int total, qint64 elapsedMs)
+{
+	QVector<qint64> sorted = stats.latencyUs;
+	std::sort(sorted.begin(), sorted.end());
+
+	double seconds = qMax<qint64>(1, elapsedMs) / 1000.0;
+	printf("queries:     %d\n", total);
+	printf("duration:    %.3f s\n", seconds);
+	printf("throughput:  %.1f queries/s\n", total / seconds);
+	printf("latency p50: %.3f ms\n", percentile(sorted, 0.50) / 1000.0);
+	printf("latency p95: %.3f ms\n", percentile(sorted, 0.95) / 1000.0);
+	printf("latency p99: %.3f ms\n", percentile(sorted, 0.99) / 1000.0);
+	printf("latency max: %.3f ms\n", (sorted.isEmpty() ? 0 : sorted.last()) / 1000.0);
+	printf("errors:      %d (%.2f %%)\n", stats.errors,
+		   total > 0 ? 100.0 * stats.errors / total : 0.0);
+	printf("retries:     %d\n", stats.retries);
+
+	QMapIterator<QString, int> it(stats.errorTexts);
+	while (it.hasNext()) {
+		it.next();
+		printf("  %6d x %s\n", it.value(), qPrintable(it.key()));
+	}
+	fflush(stdout);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("AsyncSqlReplay");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Replays a query log through AsyncQuery.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("log", "Query log, one JSON object per line.");
+	QCommandLineOption dbOption("db", "SQLite database file.", "file", "data/Northwind.sl3");
+	QCommandLineOption driverOption("driver", "Qt sql driver.", "name", "QSQLITE");
+	QCommandLineOption concurrencyOption("concurrency",
+		"Number of threads of the pool, 0 keeps the default.", "n", "0");
+	QCommandLineOption rateOption("rate",
+		"Submit with a fixed rate in queries/s instead of the logged times, "
+		"0 submits as fast as possible.", "qps");
+	QCommandLineOption speedOption("speed", "Factor applied to the logged times.",
+		"factor", "1");
+	QCommandLineOption repeatOption("repeat", "Number of times the log is replayed.",
+		"n", "1");
+	QCommandLineOption retryOption("retries",
+		"Maximum number of attempts for transient errors.", "n", "1");
+	parser.addOption(dbOption);
+	parser.addOption(driverOption);
+	parser.addOption(concurrencyOption);
+	parser.addOption(rateOption);
+	parser.addOption(speedOption);
+	parser.addOption(repeatOption);
+	parser.addOption(retryOption);
+	parser.process(app);
+
+	if (parser.positionalArguments().size() != 1) {
+		parser.showHelp(1);
+	}
+
+	QVector<LogEntry> log;
+	QString error;
+	if (!readLog(parser.positionalArguments().first(), &log, &error)) {
+		fprintf(stderr, "Cannot read log: %s\n", qPrintable(error));
+		return 1;
+	}
+
+	//build the schedule: submission time of each entry in ms
+	const int repeat = qMax(1, parser.value(repeatOption).toInt());
+	const bool fixedRate = parser.isSet(rateOption);
+	const double rate = parser.value(rateOption).toDouble();
+	const double speed = qMax(0.001, parser.value(speedOption).toDouble());
+	QVector<const LogEntry*> entries;
+	QVector<qint64> due;
+	qint64 offset = 0;
+	for (int rr = 0; rr < repeat; rr++) {
+		qint64 last = 0;
+		for (int ii = 0; ii < log.size(); ii++) {
+			entries << &log.at(ii);
+			if (fixedRate) {
+				due << (rate > 0 ? qint64(due.size() * 1000.0 / rate) : 0);
+			} else {
+				last = qint64((log.at(ii).t - log.first().t) / speed);
+				due << offset + last;
+			}
+		}
+		offset += last + 1;
+	}
+
+	const int concurrency = parser.value(concurrencyOption).toInt();
+	if (concurrency > 0) {
+		QThreadPool::globalInstance()->setMaxThreadCount(concurrency);
+	}
+
+	Database::ConnectionManager *mgr = Database::ConnectionManager::createInstance();
+	mgr->setType(parser.value(driverOption));
+	mgr->setDatabaseName(parser.value(dbOption));
+
+	Database::RetryPolicy retryPolicy;
+	retryPolicy.setMaxAttempts(parser.value(retryOption).toInt());
+
+	Stats stats;
+	stats.errors = 0;
+	stats.retries = 0;
+	int submitted = 0;
+	int done = 0;
+	QElapsedTimer clock;
+
+	//serialized streams, results arrive in order of submission
+	QHash<QString, Database::AsyncQuery*> streams;
+	QHash<QString, QQueue<qint64>> streamStarts;
+	//keyed entries, results of different keys interleave, the start time is the tag
+	Database::AsyncQuery *keyed = nullptr;
+
+	auto completed = [&]() {
+		if (++done == entries.size()) {
+			report(stats, done, clock.elapsed());
+			app.quit();
+		}
+	};
+	auto finished = [&](const Database::AsyncQueryResult &res, qint64 startUs) {
+		stats.latencyUs << (clock.nsecsElapsed() / 1000 - startUs);
+		stats.retries += res.retryCount();
+		if (!res.isValid()) {
+			stats.errors++;
+			stats.errorTexts[res.error().text()]++;
+		}
+		completed();
+	};
+	//a rejected entry never emits execDone
+	auto rejected = [&]() {
+		stats.errors++;
+		stats.errorTexts["rejected by the admission control"]++;
+		completed();
+	};
+
+	std::function<void()> submitDue;
+	submitDue = [&]() {
+		while (submitted < entries.size() && due.at(submitted) <= clock.elapsed()) {
+			const LogEntry *entry = entries.at(submitted++);
+			const qint64 startUs = clock.nsecsElapsed() / 1000;
+
+			Database::AsyncQuery *query = nullptr;
+			if (entry->mode == "keyed") {
+				if (keyed == nullptr) {
+					keyed = new Database::AsyncQuery(&app);
+					keyed->setMode(Database::AsyncQuery::Mode_KeyedSerial);
+					keyed->setRetryPolicy(retryPolicy);
+					QObject::connect(keyed, &Database::AsyncQuery::execDone, keyed,
+									 [&](const Database::AsyncQueryResult &res) {
+						finished(res, res.tag().toLongLong());
+					});
+				}
+				query = keyed;
+				query->setTag(startUs);
+			} else if (entry->stream.isEmpty()) {
+				query = new Database::AsyncQuery(&app);
+				query->setRetryPolicy(retryPolicy);
+				QObject::connect(query, &Database::AsyncQuery::execDone, query,
+								 [&, query, startUs](const Database::AsyncQueryResult &res) {
+					finished(res, startUs);
+					query->deleteLater();
+				});
+			} else {
+				query = streams.value(entry->stream, nullptr);
+				if (query == nullptr) {
+					query = new Database::AsyncQuery(&app);
+					query->setMode(Database::AsyncQuery::Mode_Fifo);
+					query->setRetryPolicy(retryPolicy);
+					const QString stream = entry->stream;
+					QObject::connect(query, &Database::AsyncQuery::execDone, query,
+									 [&, stream](const Database::AsyncQueryResult &res) {
+						finished(res, streamStarts[stream].dequeue());
+					});
+					streams.insert(entry->stream, query);
+				}
+				streamStarts[entry->stream].enqueue(startUs);
+			}
+
+			bool accepted;
+			if (entry->bind.isEmpty()) {
+				if (query == keyed) {
+					accepted = query->startExecKeyed(entry->key, entry->sql);
+				} else {
+					accepted = query->startExec(entry->sql);
+				}
+			} else {
+				query->prepare(entry->sql);
+				query->clearBoundValues();
+				QMapIterator<QString, QVariant> it(entry->bind);
+				while (it.hasNext()) {
+					it.next();
+					query->bindValue(it.key(), it.value());
+				}
+				if (query == keyed) {
+					accepted = query->startExecKeyed(entry->key);
+				} else {
+					accepted = query->startExec();
+				}
+			}
+
+			if (!accepted) {
+				//the start time of a stream belongs to the entry just queued
+				if (query != keyed && entry->stream.isEmpty()) {
+					query->deleteLater();
+				} else if (query != keyed) {
+					streamStarts[entry->stream].removeLast();
+				}
+				rejected();
+			}
+		}
+
+		if (submitted < entries.size()) {
+			qint64 wait = due.at(submitted) - clock.elapsed();
+			QTimer::singleShot(int(qMax<qint64>(0, wait)), submitDue);
+		}
+	};
+
+	if (entries.isEmpty()) {
+		fprintf(stderr, "The log is empty\n");
+		return 1;
+	}
+
+	clock.start();
+	QTimer::singleShot(0, submitDue);
+	int ret = app.exec();
+
+	qDeleteAll(streams);
+	delete keyed;
+	Database::ConnectionManager::destroyInstance();
+	return ret;
+}
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Headless replay of query logs through AsyncQuery
+#
+#-------------------------------------------------
+
+QT += core sql
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = AsyncSqlReplay
+TEMPLATE = app
+
+SOURCES += main.cpp
+
+include(../../Database/Database.pri)